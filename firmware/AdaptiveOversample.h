@@ -0,0 +1,75 @@
+#ifndef __ADAPTIVE_OVERSAMPLE_H__
+#define __ADAPTIVE_OVERSAMPLE_H__
+
+/*
+ * AdaptiveOversample.h - Chooses how many ADC samples to take for a channel each polling
+ *                        period based on the measured noise of that channel.
+ *
+ * The standard error of the mean of 'n' samples with standard deviation 'sigma' is
+ * 'sigma / sqrt(n)'.  Given a target standard error for the temperature, the smallest
+ * sufficient sample count is therefore:
+ *
+ *    n = (sigma_adc * celsius_per_lsb / target_celsius)^2
+ *
+ * where 'sigma_adc' is the noise in ADC units and 'celsius_per_lsb' is the local slope of
+ * the thermistor curve at the current reading.
+ *
+ * 'sigma_adc' is estimated online from the variance of each period's samples, smoothed with
+ * an exponentially weighted moving average so that a single noisy period (e.g., while the
+ * relay switches) raises the sample count quickly while quiet periods lower it gradually.
+ */
+
+#include <math.h>
+
+class AdaptiveOversample {
+  private:
+    // Weight given to the newest period's variance when it is lower/higher than the current
+    // estimate.  Noise increases are tracked faster than decreases.
+    static constexpr double _alpha_falling = 0.125;
+    static constexpr double _alpha_rising = 0.5;
+
+    double _variance = -1;                    // Smoothed ADC variance (negative until the first update)
+
+  public:
+    // Folds the ADC variance measured during the last polling period into the estimate.
+    void update(double periodVariance) {
+      if (_variance < 0) {
+        _variance = periodVariance;
+        return;
+      }
+
+      double alpha = periodVariance > _variance
+        ? _alpha_rising
+        : _alpha_falling;
+
+      _variance += alpha * (periodVariance - _variance);
+    }
+
+    // Smoothed standard deviation of the ADC samples (in LSBs), or a negative value if no
+    // periods have been measured yet.
+    double noise() const {
+      return _variance < 0
+        ? -1
+        : sqrt(_variance);
+    }
+
+    // Returns the number of samples [minCount..maxCount] needed to achieve 'targetStdErr'
+    // (in Celsius), given the thermistor slope 'celsiusPerLsb' at the current reading.
+    // Returns 'maxCount' until the noise has been measured, or if 'targetStdErr' <= 0.
+    uint8_t sampleCount(double celsiusPerLsb, double targetStdErr, uint8_t minCount, uint8_t maxCount) const {
+      if (_variance < 0 || targetStdErr <= 0) {
+        return maxCount;
+      }
+
+      double ratio = sqrt(_variance) * fabs(celsiusPerLsb) / targetStdErr;
+      double n = ceil(ratio * ratio);
+
+      return n < minCount
+        ? minCount
+        : n > maxCount
+          ? maxCount
+          : static_cast<uint8_t>(n);
+    }
+};
+
+#endif // __ADAPTIVE_OVERSAMPLE_H__
@@ -0,0 +1,83 @@
+#ifndef __ADAPTIVE_POLLING_H__
+#define __ADAPTIVE_POLLING_H__
+
+/*
+ * AdaptivePolling.h - Chooses the length of each polling period from how close the
+ *                     temperatures are to changing the relay's state.
+ *
+ * Each period, the caller reports the 'distance' (in Celsius) the temperatures are from the
+ * nearest decision boundary (e.g., 'deltaTOn' while the relay is open.)  The rate at which
+ * the distance is closing is estimated from consecutive periods and smoothed with an
+ * exponentially weighted moving average.  The next period is then:
+ *
+ *    - The minimum while within '_near_celsius' of the boundary.
+ *    - Short enough to take '_samples_before_near' samples before the temperatures are
+ *      projected to come within '_near_celsius' at the current rate.  (Shortened immediately.)
+ *    - Otherwise, double the previous period (i.e., exponential backoff while the system is
+ *      far from, or moving away from, any decision.)
+ *
+ * and is always clamped to the configured [min..max].
+ */
+
+#include <math.h>
+
+class AdaptivePolling {
+  private:
+    static constexpr double _near_celsius = 1.0;          // Poll at the minimum period within this distance
+    static constexpr double _samples_before_near = 4;     // Samples to take before a projected approach
+    static constexpr double _alpha = 0.5;                 // Weight given to the newest period's rate
+
+    bool     _has_distance = false;           // True once a distance has been reported
+    double   _last_distance = 0;              // Distance reported by the last 'update()'
+    uint32_t _last_millis = 0;                // 'millis()' when '_last_distance' was measured
+    double   _closing_rate = 0;               // Smoothed rate of approach (Celsius per ms, positive if approaching)
+    uint32_t _period_millis = 0;              // Period returned by the last 'update()' (0 until the first)
+
+  public:
+    // Discards the rate estimate.  (Call when the boundary itself changes, i.e., when the
+    // relay changes state.)
+    void reset() {
+      _has_distance = false;
+      _closing_rate = 0;
+    }
+
+    // Folds in the 'distance' measured at 'nowMillis', and returns the length of the next
+    // polling period [minMillis..maxMillis].
+    uint32_t update(double distance, uint32_t nowMillis, uint32_t minMillis, uint32_t maxMillis) {
+      uint32_t elapsedMillis = nowMillis - _last_millis;
+      if (_has_distance && elapsedMillis > 0) {
+        double rate = (_last_distance - distance) / elapsedMillis;
+        _closing_rate += _alpha * (rate - _closing_rate);
+      }
+      _last_distance = distance;
+      _last_millis = nowMillis;
+      _has_distance = true;
+
+      double next;
+      if (distance <= _near_celsius) {
+        next = minMillis;
+      } else {
+        double doubled = _period_millis > 0
+          ? 2.0 * _period_millis
+          : minMillis;
+
+        // Time until the temperatures are projected to come within '_near_celsius'.
+        double horizon = _closing_rate > 0
+          ? (distance - _near_celsius) / _closing_rate
+          : INFINITY;
+
+        next = fmin(doubled, horizon / _samples_before_near);
+      }
+
+      _period_millis = next < minMillis
+        ? minMillis
+        : next > maxMillis
+          ? maxMillis
+          : static_cast<uint32_t>(next);
+      return _period_millis;
+    }
+
+    uint32_t getPeriodMillis() const { return _period_millis; }
+};
+
+#endif // __ADAPTIVE_POLLING_H__
@@ -7,109 +7,424 @@
  */
 
 #include <FirebaseArduino.h>
+#include "DeepSleep.h"
+#include "Device.h"
+#include "EventQueue.h"
+#include "LocalStorage.h"
+#include "SampleFilter.h"
+#include "SampleHistory.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "MetricNames.h"
+#include "Trace.h"
+
+// Bucket bounds (in seconds) of the 'dtc_cloud_log_seconds' histogram.
+static const float _cloud_log_seconds_bounds[] = { 0.1, 0.25, 0.5, 1, 2.5, 5 };
 
 class CloudStorage {
-  private:
+  public:
+    // Thermistor parameters for a single channel.  (See corresponding fields of 'Config'.)
+    struct ThermistorConfig {
+      float series_resistor;
+      float resistance_at_0;
+      float temperature_at_0;
+      float b_coefficient;
+      float compression_deviation;
+    };
+
     // We store as much of the configuration as possible in the cloud so that we can change
-    // these parameters without reflashing the device.  The values below are overwritten by
-    // the value stored the specified path in the Firebase database (if any).
+    // these parameters without reflashing the device.  The defaults below are overwritten by
+    // the value stored at the corresponding path in the Firebase database (if any).
+    //
+    // 'Config' is plain old data so that the last config retrieved from Firebase can be cached
+    // in flash as a single record.  (See 'loadCached()' and 'saveCached()'.)  Increment
+    // '_config_version' when changing its layout.
+    struct Config {
+      // Optional revision number of the config in Firebase.  Only logged, to identify which
+      // config a device is running.  (The config Firebase serves is authoritative, and replaces
+      // the cached copy whenever they differ, whatever their revisions.)
+      int     revision                              = 0;
+
+      // The fixed resistance in ohms of the resistor in the voltage divider.
+      // (See R1 in 'docs/schematic.png'.)
+      float   series_resistor                       = 8170;
+
+      // The measured resistance of the thermistor (in ohms) at a known temperature.
+      float   resistance_at_0                       = 9555.55;
+
+      // The known temperature of the thermistor at which 'resistance_at_0' was measured.
+      float   temperature_at_0                      = 25;
+
+      // The calculated B-coefficient of the thermistor in the B parameter equation.
+      // (See https://en.wikipedia.org/wiki/Thermistor#B_or_.CE.B2_parameter_equation)
+      float   b_coefficient                         = 3380;
+
+      // The number of thermistors connected to the mux [2..8].  Channel 0 is the pool (or room,
+      // etc.) and channel 1 is the collector.  Additional channels are only monitored/logged.
+      int     channels                              = 2;
+
+      // The maximum error (in Celsius) of the temperature trend reconstructed by linearly
+      // interpolating between logged samples.  Samples within this of the trend are not logged,
+      // or 0 to log a channel's every change.  (Every sample is logged while 0 for all channels.
+      // See SwingingDoor.h.)
+      float   compression_deviation                 = 0;
+
+      // Per-channel thermistor parameters (and 'compression_deviation'), stored at
+      // 'thermistors/<channel>/<name>' using the same names as the parameters above.  Any parameter missing for a channel defaults to
+      // the corresponding value above.
+      ThermistorConfig thermistors[Device::_max_channels];
+
+      // The frequency at which we make a decision about engaging/disengaging the solar
+      // collector (and at which we log temperature data to the Firebase database).
+      int     polling_milliseconds                  = 5 * 1000;
+
+      // Bounds on the polling period when it adapts to how close the temperatures are to
+      // engaging/disengaging the collector.  (See AdaptivePolling.h.)  The period is fixed at
+      // 'polling_milliseconds' while either is 0.
+      int     polling_min_milliseconds              = 0;
+      int     polling_max_milliseconds              = 0;
+
+      // The maximum number of temperature sample points we store in the Firebase database.
+      int     max_entries                           = 0;
+
+      // The GMT offset.  Only used when printing diagnostics to the serial monitor.
+      // All data logged to the Firebase uses UTC timestamps.
+      int     gmt_offset                            = 0;
+
+      // The minimum absolute temperature required to engage the solar collector.  (Used
+      // to prevent engaging the collector during near freezing conditions.)
+      float   min_t_on                              = 10;
+
+      // The minimum temperature differential between the solar collector and room, pool, etc.
+      // required to engage the solar collector.
+      // 
+      // (Set this sufficiently higher than 'delta_t_off' such that the collector doesn't
+      // immediately disengage when we begin circulating air, water, etc. through it.)
+      float   delta_t_on                            = 10;
+
+      // The minimal temperature differential between the solar collector and room, pool, etc.
+      // required to keep the collector engaged.  (See notes on 'delta_t_on' declaration.)
+      float   delta_t_off                           = 1;
+
+      // The number of temperature sample points taken and averaged between each iteration
+      // of the polling loop.  (Used to smooth transient noise.)
+      int     oversample                            = 16;
+
+      // The target standard error (in Celsius) of each channel's temperature per polling period.
+      // When > 0, the number of samples taken per channel is adapted to the measured noise,
+      // between 'min_oversample' and 'oversample'.  (See AdaptiveOversample.h.)  When 0,
+      // 'oversample' samples are always taken.
+      float   target_std_err                        = 0;
+
+      // The minimum number of samples per channel per polling period when adapting.  (At least
+      // 2 are required to measure the noise.)
+      int     min_oversample                        = 4;
+
+      // The number of consecutive samples taken from a channel each time the mux selects it.
+      // Larger values reduce the number of mux switches (and settling delays) by the same
+      // factor, at the cost of samples that are less evenly spread through the period.
+      int     burst                                 = 1;
+
+      // Time (in microseconds) allowed for the mux output to settle after switching channels.
+      // If 0, the settling time measured by 'Device::calibrateSettling()' at boot is used.
+      int     mux_settle_micros                     = 0;
+
+      // The percentage of samples discarded from each end when 'filter' is 'trimmed'.
+      int     trim_percent                          = 25;
+
+      // The number of scaled median absolute deviations beyond which samples are rejected
+      // when 'filter' is 'hampel'.
+      float   hampel_threshold                      = 3;
+
+      // The number of most recent samples included in the short-term and long-term rolling
+      // temperature statistics (mean, stddev, min, max) maintained by 'SampleHistory'.
+      // [1..SampleHistory::_capacity]
+      int     stats_window                          = 12;
+      int     stats_long_window                     = SampleHistory::_capacity;
+
+      // The number of samples logged per upload.  When > 1, the radio is powered down between
+      // uploads (during which the local server is unreachable.)  When 1, each sample is logged
+      // as it is taken and the radio remains on.  [1..SampleHistory::_capacity]  (See Radio.h.)
+      int     upload_every                          = 1;
+
+      // Time (in seconds) to deep sleep between samples while the collector is idle, or 0 to
+      // remain awake.  (See DeepSleep.h.)
+      int     deep_sleep_seconds                    = 0;
+
+      // The number of samples batched in RTC memory during deep sleep before waking the radio
+      // to upload them.  [1..DeepSleep::_max_batch]
+      int     deep_sleep_upload_every               = 6;
+
+      // The collector is considered idle (i.e., may deep sleep) while the relay is open and the
+      // temperature differential is at least this much (in Celsius) below 'delta_t_on'.
+      float   deep_sleep_margin                     = 5;
+
+      // Messages above this level are not logged: 0 = none, 1 = error, 2 = warn, 3 = info,
+      // 4 = debug.  (Messages above the compile-time level are never logged.  See Log.h.)
+      int     log_level                             = LOG_LEVEL_DEBUG;
+
+      // The NTP server used to synchronize the 'Time' library.
+      char    ntp_server[64]                        = "pool.ntp.org";
+
+      // How the oversampled ADC values are combined: 'mean', 'median', 'trimmed' or 'hampel'.
+      // (See SampleFilter.h.)
+      char    filter[12]                            = "mean";
+    };
 
-    const char* const _config_ref                   = "config";
+  private:
+    // Version of the 'Config' layout cached in flash.
+    static const uint16_t _config_version           = 7;
 
-    // The fixed resistance in ohms of the resistor in the voltage divider.
-    // (See R1 in 'docs/schematic.png'.)
-    const char* const _series_resistor_ref          = "seriesResistor";
-    float   _series_resistor                        = 8170;
+    // Name of the record in which the last config retrieved from Firebase is cached.
+    const char* const _cache_record_name            = "/cloud-config";
 
-    // The measured resistance of the thermistor (in ohms) at a known temperature.
+    // The maximum number of samples 'SampleFilter' accepts per polling period.  Larger
+    // 'oversample' values from the cloud are clamped to this.
+    static const int _max_oversample                = SampleFilter::_max_samples;
+
+    Config _config;
+
+    // Path to the config in the Firebase database, and of each value within the config.
+    // (See the corresponding fields of 'Config' for a description of each value.)
+    const char* const _config_ref                   = "config";
+    const char* const _revision_ref                 = "revision";
+    const char* const _series_resistor_ref          = "seriesResistor";
     const char* const _resistance_at_0_ref          = "resistanceAt0";
-    float   _resistance_at_0                        = 9555.55;
-    
-    // The known temperature of the thermistor at which '_resistance_at_0' was measured.
     const char* const _temperature_at_0_ref         = "temperatureAt0";
-    float   _temperature_at_0                       = 25;
-
-    // The calculated B-coefficient of the thermistor in the B parameter equation.
-    // (See https://en.wikipedia.org/wiki/Thermistor#B_or_.CE.B2_parameter_equation)
     const char* const _b_coefficient_ref            = "bCoefficient";
-    float   _b_coefficient                          = 3380;
-
-    // The frequency at which we make a decision about engaging/disengaging the solar
-    // collector (and at which we log temperature data to the Firebase database).
+    const char* const _compression_deviation_ref    = "compressionDeviation";
+    const char* const _channels_ref                 = "channels";
+    const char* const _thermistors_ref              = "thermistors";
     const char* const _polling_milliseconds_ref     = "pollingMilliseconds";
-    int     _polling_milliseconds                   = 5 * 1000;
-
-    // The maximum number of temperature sample points we store in the Firebase database.
+    const char* const _polling_min_milliseconds_ref = "pollingMinMilliseconds";
+    const char* const _polling_max_milliseconds_ref = "pollingMaxMilliseconds";
     const char* const _max_entries_ref              = "maxEntries";
-    int     _max_entries                            = 0;
-
-    // The NTP server used to synchronize the 'Time' library.
     const char* const _ntp_server_ref               = "ntpServer";
-    String  _ntp_server                             = "pool.ntp.org";
-
-    // The GMT offset.  Only used when printing diagnostics to the serial monitor.
-    // All data logged to the Firebase uses UTC timestamps.
     const char* const _gmt_offset_ref               = "gmtOffset";
-    int     _gmt_offset                             = 0;
-
-    // The minimum absolute temperature required to engage the solar collector.  (Used
-    // to prevent engaging the collector during near freezing conditions.)
-    const char* const _min_t_on_ref               = "minTOn";
-    float   _min_t_on                             = 10;
-
-    // The minimum temperature differential between the solar collector and room, pool, etc.
-    // required to engage the solar collector.
-    // 
-    // (Set this sufficiently higher than '_delta_t_off' such that the collector doesn't
-    // immediately disengage when we begin circulating air, water, etc. through it.)
+    const char* const _min_t_on_ref                 = "minTOn";
     const char* const _delta_t_on_ref               = "deltaTOn";
-    float   _delta_t_on                             = 10;
-
-    // The minimal temperature differential between the solar collector and room, pool, etc.
-    // required to keep the collector engaged.  (See notes on '_delta_t_on' declaration.)
-    const char* const _delta_t_off_ref             = "deltaTOff";
-    float   _delta_t_off                            = 1;
-
-    // The number of temperature sample points taken and averaged between each iteration
-    // of the polling loop.  (Used to smooth transient noise.)
+    const char* const _delta_t_off_ref              = "deltaTOff";
     const char* const _oversample_ref               = "oversample";
-    int     _oversample                             = 16;
+    const char* const _target_std_err_ref           = "targetStdErr";
+    const char* const _min_oversample_ref           = "minOversample";
+    const char* const _burst_ref                    = "burst";
+    const char* const _mux_settle_micros_ref        = "muxSettleMicros";
+    const char* const _filter_ref                   = "filter";
+    const char* const _trim_percent_ref             = "trimPercent";
+    const char* const _hampel_threshold_ref         = "hampelThreshold";
+    const char* const _stats_window_ref             = "statsWindow";
+    const char* const _stats_long_window_ref        = "statsLongWindow";
+    const char* const _upload_every_ref             = "uploadEvery";
+    const char* const _deep_sleep_seconds_ref       = "deepSleepSeconds";
+    const char* const _deep_sleep_upload_every_ref  = "deepSleepUploadEvery";
+    const char* const _deep_sleep_margin_ref        = "deepSleepMargin";
+    const char* const _log_level_ref                = "logLevel";
 
     // Path to here datapoints are logged in the Firebase database.
     const String _log_ref                           = String("log");
 
-    // The current log entry (wraps at '_max_entries'.)
+    // Path to where events are logged in the Firebase database.  (See EventQueue.h.)
+    const String _events_ref                        = String("events");
+
+    // The current log entry (wraps at 'max_entries'.)
     uint32_t _current_entry                         = 0;
 
+    // The current events log entry (wraps at 'max_entries'.)
+    uint32_t _current_event                         = 0;
+
+    // Metrics of 'log()' and 'logEvent()'.
+    Counter _logged_metric { METRIC(logged) };
+    Counter _events_logged_metric { METRIC(events_logged) };
+    Counter _log_retries_metric { METRIC(log_retries) };
+    Counter _log_failures_metric { METRIC(log_failures) };
+    Histogram<6> _log_seconds_metric { METRIC(log_seconds), _cloud_log_seconds_bounds };
+
   public:
-    // Public read-only accessors for exposed fields.  (See comments on field declarations above.)
-    int getPollingMilliseconds() const { return _polling_milliseconds; }
-    double getSeriesResistor() const { return _series_resistor; }
-    double getResistanceAt0() const { return _resistance_at_0; }
-    double getTemperatureAt0() const { return _temperature_at_0; }
-    double getBCoefficient() const { return _b_coefficient; }
-    double getMinTOn() const { return _min_t_on; }
-    double getDeltaTOn() const { return _delta_t_on; }
-    double getDeltaTOff() const { return _delta_t_off; }
-    double getOversample() const { return _oversample; }
-    const char* const getNtpServer() const { return _ntp_server.c_str(); }
+    // Public read-only accessors for exposed fields.  (See comments on 'Config' fields above.)
+    int getPollingMilliseconds() const { return _config.polling_milliseconds; }
+    bool isPollingAdaptive() const {
+      return _config.polling_min_milliseconds > 0 && _config.polling_max_milliseconds > 0;
+    }
+    uint32_t getPollingMinMilliseconds() const {
+      return isPollingAdaptive()
+        ? _config.polling_min_milliseconds
+        : _config.polling_milliseconds;
+    }
+    uint32_t getPollingMaxMilliseconds() const {
+      return !isPollingAdaptive()
+        ? _config.polling_milliseconds
+        : _config.polling_max_milliseconds < _config.polling_min_milliseconds
+          ? _config.polling_min_milliseconds
+          : _config.polling_max_milliseconds;
+    }
+    int getChannels() const {
+      return _config.channels < 2
+        ? 2
+        : _config.channels > Device::_max_channels
+          ? Device::_max_channels
+          : _config.channels;
+    }
+    double getSeriesResistor(int channel) const { return thermistor(channel).series_resistor; }
+    double getResistanceAt0(int channel) const { return thermistor(channel).resistance_at_0; }
+    double getTemperatureAt0(int channel) const { return thermistor(channel).temperature_at_0; }
+    double getBCoefficient(int channel) const { return thermistor(channel).b_coefficient; }
+    float getCompressionDeviation(int channel) const {
+      return thermistor(channel).compression_deviation < 0
+        ? 0
+        : thermistor(channel).compression_deviation;
+    }
+    double getMinTOn() const { return _config.min_t_on; }
+    double getDeltaTOn() const { return _config.delta_t_on; }
+    double getDeltaTOff() const { return _config.delta_t_off; }
+    double getOversample() const {
+      return _config.oversample < 1
+        ? 1
+        : _config.oversample > _max_oversample
+          ? _max_oversample
+          : _config.oversample;
+    }
+    float getTargetStdErr() const { return _config.target_std_err; }
+    int getMinOversample() const {
+      int maxOversample = getOversample();
+      return _config.min_oversample > maxOversample
+        ? maxOversample
+        : _config.min_oversample < 2
+          ? 2
+          : _config.min_oversample;
+    }
+    uint8_t getBurst() const {
+      int maxOversample = getOversample();
+      return _config.burst > maxOversample
+        ? maxOversample
+        : _config.burst < 1
+          ? 1
+          : _config.burst;
+    }
+    uint32_t getMuxSettleMicros() const { return _config.mux_settle_micros > 0 ? _config.mux_settle_micros : 0; }
+    const char* const getFilter() const { return _config.filter; }
+    uint8_t getTrimPercent() const {
+      assert(0 <= _config.trim_percent && _config.trim_percent < 50);
+
+      return static_cast<uint8_t>(_config.trim_percent);
+    }
+    float getHampelThreshold() const { return _config.hampel_threshold; }
+    int getStatsWindow() const { return _config.stats_window; }
+    int getStatsLongWindow() const { return _config.stats_long_window; }
+    const char* const getNtpServer() const { return _config.ntp_server; }
     int8_t getGmtOffset() const {
-      assert(-11 <= _gmt_offset && _gmt_offset <= 13);
+      assert(-11 <= _config.gmt_offset && _config.gmt_offset <= 13);
       
-      return static_cast<int8_t>(_gmt_offset);
+      return static_cast<int8_t>(_config.gmt_offset);
+    }
+    uint8_t getUploadEvery() const {
+      return _config.upload_every < 1
+        ? 1
+        : _config.upload_every > SampleHistory::_capacity
+          ? SampleHistory::_capacity
+          : _config.upload_every;
+    }
+    uint32_t getDeepSleepSeconds() const {
+      // (Limited by the range of the ESP8266's RTC timer, which is a little over an hour.)
+      return _config.deep_sleep_seconds < 0
+        ? 0
+        : _config.deep_sleep_seconds > 3600
+          ? 3600
+          : _config.deep_sleep_seconds;
+    }
+    uint8_t getDeepSleepUploadEvery() const {
+      return _config.deep_sleep_upload_every < 1
+        ? 1
+        : _config.deep_sleep_upload_every > DeepSleep::_max_batch
+          ? DeepSleep::_max_batch
+          : _config.deep_sleep_upload_every;
+    }
+    float getDeepSleepMargin() const { return _config.deep_sleep_margin; }
+    uint8_t getLogLevel() const {
+      return _config.log_level < LOG_LEVEL_NONE
+        ? LOG_LEVEL_NONE
+        : _config.log_level > LOG_LEVEL_DEBUG
+          ? LOG_LEVEL_DEBUG
+          : _config.log_level;
+    }
+    int getRevision() const { return _config.revision; }
+
+    // Returns false if a config value is outside the range its getter (or the code using it)
+    // requires.  (Values that are clamped by their getters are always valid.)
+    bool isValid() const { return isValid(_config); }
+
+    // Prints the current value of each config setting (by its Firebase name.)
+    void printConfigTo(Print& out) {
+      ValuePrinter printer { out };
+      forEachValue(printer);
+    }
+
+    // Overrides the config setting named 'ref' (its Firebase name) with 'text', until the
+    // config is next retrieved from Firebase (or the device reboots.)  Returns false if there
+    // is no such setting, or 'text' is not a valid value.  (Setting a shared thermistor
+    // parameter replaces any per-channel overrides.)
+    bool set(const char* ref, const char* text) {
+      Config previous = _config;
+
+      ValueParser parser { ref, text, false };
+      forEachValue(parser);
+      if (!parser.parsed) {
+        return false;
+      }
+
+      if (!isValid()) {
+        _config = previous;
+        return false;
+      }
+
+      bool isSharedThermistorParameter = strcmp(ref, _series_resistor_ref) == 0
+        || strcmp(ref, _resistance_at_0_ref) == 0
+        || strcmp(ref, _temperature_at_0_ref) == 0
+        || strcmp(ref, _b_coefficient_ref) == 0
+        || strcmp(ref, _compression_deviation_ref) == 0;
+      if (isSharedThermistorParameter) {
+        applySharedThermistorConfig(_config);
+      }
+      return true;
     }
     
   private:
+    static bool isValid(const Config& config) {
+      return 0 <= config.trim_percent && config.trim_percent < 50
+        && -11 <= config.gmt_offset && config.gmt_offset <= 13
+        && config.max_entries > 0
+        && config.polling_milliseconds >= 0
+        && config.polling_min_milliseconds >= 0
+        && config.polling_max_milliseconds >= 0;
+    }
+
+    const ThermistorConfig& thermistor(int channel) const {
+      assert(0 <= channel && channel < Device::_max_channels);
+      return _config.thermistors[channel];
+    }
+
+    // Resets each channel's thermistor parameters in 'config' to the shared parameters.
+    static void applySharedThermistorConfig(Config& config) {
+      for (int channel = 0; channel < Device::_max_channels; channel++) {
+        config.thermistors[channel] = {
+          config.series_resistor,
+          config.resistance_at_0,
+          config.temperature_at_0,
+          config.b_coefficient,
+          config.compression_deviation
+        };
+      }
+    }
+
     // Convenience wrapper around 'Firebase.failed()' that additionally prints '[FAILED]'
     // plus the error message when 'Firebase.failed()' returns true.
     //
     // Prints nothing when 'Firebase.failed()' returns false, as the caller typically
     // prints the value on success:
     //
-    //     Serial.print("Get 'foo/bar': ");
+    //     LOG(CLOUD, INFO, F("Get 'foo/bar': "));
     //     int value = Firebase.getInt(...);
     //     if (!failed()) {                         // Implicitly print failure message if unsuccessful.
-    //       Serial.println(value);                 // ...otherwise print the value.
+    //       LOGLN(CLOUD, INFO, value);             // ...otherwise print the value.
     //     }
     //
     bool failed() {
@@ -119,8 +434,8 @@ class CloudStorage {
       }
 
       // Otherwise print the failure message.
-      Serial.println("[FAILED]");
-      Serial.print("    (Firebase Error: '"); Serial.print(Firebase.error()); Serial.println("')");
+      LOGLN(CLOUD, WARN, F("[FAILED]"));
+      LOGLN(CLOUD, WARN, F("    (Firebase Error: '"), Firebase.error(), F("')"));
       return true;
     }
     
@@ -131,14 +446,14 @@ class CloudStorage {
     // (This was used during development to fallback on built-in default values before the Firebase
     // database was populated.)
     template <typename T> bool maybeUpdate(T (*getFn)(FirebaseObject& obj, const String& path), FirebaseObject& obj, const char* const path, T& value) {
-      Serial.print("  Accessing '"); Serial.print(path); Serial.print("': ");
+      LOG(CLOUD, DEBUG, F("  Accessing '"), path, F("': "));
       T maybeNewValue = getFn(obj, path);
       if (failed()) {
         return false;
       }
 
       value = maybeNewValue;
-      Serial.println(value);
+      LOGLN(CLOUD, DEBUG, value);
       return true;
     };
 
@@ -165,12 +480,131 @@ class CloudStorage {
       return maybeUpdate<String>(Firebase_getString, obj, path, value);
     }
 
+    // Updates the null-terminated 'value' (of capacity 'size') with the Firebase value at
+    // 'path', if any.  Otherwise (or if the Firebase value is too long) leaves 'value'
+    // unmodified and returns false.
+    bool maybeUpdateChars(FirebaseObject& obj, const char* const path, char* value, size_t size) {
+      String maybeNewValue;
+      if (!maybeUpdateString(obj, path, maybeNewValue)) {
+        return false;
+      }
+
+      if (maybeNewValue.length() >= size) {
+        LOGLN(CLOUD, WARN, F("    (Value of '"), path, F("' exceeds "), size - 1, F(" characters.)"));
+        return false;
+      }
+
+      // (Zero fill the remainder so that equal configs compare equal with 'memcmp()'.)
+      strncpy(value, maybeNewValue.c_str(), size);
+      return true;
+    }
+
+    // Calls 'visitor(ref, value)' for each config value, where 'value' is a reference to the
+    // 'int' or 'float' field, or for strings 'visitor(ref, chars, size)'.  (Per-channel
+    // thermistor parameters are not included.)
+    template <typename Visitor> void forEachValue(Visitor& visitor) {
+      visitor(_revision_ref, _config.revision);
+      visitor(_series_resistor_ref, _config.series_resistor);
+      visitor(_resistance_at_0_ref, _config.resistance_at_0);
+      visitor(_temperature_at_0_ref, _config.temperature_at_0);
+      visitor(_b_coefficient_ref, _config.b_coefficient);
+      visitor(_compression_deviation_ref, _config.compression_deviation);
+      visitor(_channels_ref, _config.channels);
+      visitor(_polling_milliseconds_ref, _config.polling_milliseconds);
+      visitor(_polling_min_milliseconds_ref, _config.polling_min_milliseconds);
+      visitor(_polling_max_milliseconds_ref, _config.polling_max_milliseconds);
+      visitor(_max_entries_ref, _config.max_entries);
+      visitor(_ntp_server_ref, _config.ntp_server, sizeof(_config.ntp_server));
+      visitor(_gmt_offset_ref, _config.gmt_offset);
+      visitor(_min_t_on_ref, _config.min_t_on);
+      visitor(_delta_t_on_ref, _config.delta_t_on);
+      visitor(_delta_t_off_ref, _config.delta_t_off);
+      visitor(_oversample_ref, _config.oversample);
+      visitor(_target_std_err_ref, _config.target_std_err);
+      visitor(_min_oversample_ref, _config.min_oversample);
+      visitor(_burst_ref, _config.burst);
+      visitor(_mux_settle_micros_ref, _config.mux_settle_micros);
+      visitor(_filter_ref, _config.filter, sizeof(_config.filter));
+      visitor(_trim_percent_ref, _config.trim_percent);
+      visitor(_hampel_threshold_ref, _config.hampel_threshold);
+      visitor(_stats_window_ref, _config.stats_window);
+      visitor(_stats_long_window_ref, _config.stats_long_window);
+      visitor(_upload_every_ref, _config.upload_every);
+      visitor(_deep_sleep_seconds_ref, _config.deep_sleep_seconds);
+      visitor(_deep_sleep_upload_every_ref, _config.deep_sleep_upload_every);
+      visitor(_deep_sleep_margin_ref, _config.deep_sleep_margin);
+      visitor(_log_level_ref, _config.log_level);
+    }
+
+    // Visitor that prints each config value.  (See 'printConfigTo()'.)
+    struct ValuePrinter {
+      Print& out;
+
+      void operator()(const char* ref, int value) {
+        out.print(F("  ")); out.print(ref); out.print(F(": ")); out.println(value);
+      }
+      void operator()(const char* ref, float value) {
+        out.print(F("  ")); out.print(ref); out.print(F(": ")); out.println(value, /* digits = */ 4);
+      }
+      void operator()(const char* ref, const char* value, size_t size) {
+        out.print(F("  ")); out.print(ref); out.print(F(": '")); out.print(value); out.println('\'');
+      }
+    };
+
+    // Visitor that parses 'text' into the config value named 'ref'.  (See 'set()'.)
+    struct ValueParser {
+      const char* ref;
+      const char* text;
+      bool parsed;
+
+      void operator()(const char* candidate, int& value) {
+        if (strcmp(candidate, ref) != 0) {
+          return;
+        }
+
+        char* end;
+        long parsedValue = strtol(text, &end, 10);
+        parsed = *text != '\0' && *end == '\0';
+        if (parsed) {
+          value = parsedValue;
+        }
+      }
+      void operator()(const char* candidate, float& value) {
+        if (strcmp(candidate, ref) != 0) {
+          return;
+        }
+
+        char* end;
+        float parsedValue = strtof(text, &end);
+        parsed = *text != '\0' && *end == '\0';
+        if (parsed) {
+          value = parsedValue;
+        }
+      }
+      void operator()(const char* candidate, char* value, size_t size) {
+        if (strcmp(candidate, ref) != 0) {
+          return;
+        }
+
+        parsed = strlen(text) < size;
+        if (parsed) {
+          strncpy(value, text, size);
+        }
+      }
+    };
+
   public:
+    CloudStorage() {
+      applySharedThermistorConfig(_config);
+    }
+
     // Update cached configuration with values from Firebase.  Returns false if 'config'
-    // was inaccessible, or any of the expected properties were missing so that caller
-    // may optionally retry.
+    // was inaccessible, any of the expected properties were missing, or a value was invalid
+    // (see 'isValid()') so that caller may optionally retry.  The current config is replaced
+    // only if the update succeeds, and is otherwise left unchanged.
     bool update(Device& device) {
-      Serial.print("Updating config from Firebase: ");
+      TRACE_SCOPE(CloudUpdate);
+      LOG(CLOUD, INFO, F("Updating config from Firebase: "));
 
       // Blink the LED rapidly to indicate network activity.
       device.blinkLed(25);
@@ -185,83 +619,227 @@ class CloudStorage {
       }
 
       // Pretty print the loaded FirebaseObject.
-      configObj.getJsonVariant().printTo(Serial); Serial.println();
+      if (LOG_ENABLED(CLOUD, INFO)) {
+        configObj.getJsonVariant().printTo(_log); _log.println();
+      }
 
-      // Extract the individual values from the FirebaseObject.  Any missing values will cause 'update()'
-      // to return false, but preserve the defaults hardcoded above.  (Useful for bootstrapping/testing.)
+      // Extract the individual values from the FirebaseObject into a copy of the current config,
+      // so that the control loop never sees a partially updated config.  Any missing values will
+      // cause 'update()' to return false.
       //
       // (See comments on variable declarations above for a description of each value.)
+      Config config = _config;
       bool success = true;
-      success &= maybeUpdateFloat(configObj, _series_resistor_ref, _series_resistor);
-      success &= maybeUpdateFloat(configObj, _temperature_at_0_ref, _temperature_at_0);
-      success &= maybeUpdateFloat(configObj, _resistance_at_0_ref, _resistance_at_0);
-      success &= maybeUpdateFloat(configObj, _b_coefficient_ref, _b_coefficient);
-      success &= maybeUpdateInt(configObj,_polling_milliseconds_ref, _polling_milliseconds);
-      success &= maybeUpdateInt(configObj, _max_entries_ref, _max_entries);
-      success &= maybeUpdateString(configObj, _ntp_server_ref, _ntp_server);
-      success &= maybeUpdateInt(configObj, _gmt_offset_ref, _gmt_offset);
-      success &= maybeUpdateFloat(configObj, _delta_t_on_ref, _delta_t_on);
-      success &= maybeUpdateFloat(configObj, _delta_t_off_ref, _delta_t_off);
-      success &= maybeUpdateFloat(configObj, _min_t_on_ref, _min_t_on);
-      success &= maybeUpdateInt(configObj, _oversample_ref, _oversample);
-      
+      success &= maybeUpdateFloat(configObj, _series_resistor_ref, config.series_resistor);
+      success &= maybeUpdateFloat(configObj, _temperature_at_0_ref, config.temperature_at_0);
+      success &= maybeUpdateFloat(configObj, _resistance_at_0_ref, config.resistance_at_0);
+      success &= maybeUpdateFloat(configObj, _b_coefficient_ref, config.b_coefficient);
+      success &= maybeUpdateInt(configObj,_polling_milliseconds_ref, config.polling_milliseconds);
+      success &= maybeUpdateInt(configObj, _max_entries_ref, config.max_entries);
+      success &= maybeUpdateChars(configObj, _ntp_server_ref, config.ntp_server, sizeof(config.ntp_server));
+      success &= maybeUpdateInt(configObj, _gmt_offset_ref, config.gmt_offset);
+      success &= maybeUpdateFloat(configObj, _delta_t_on_ref, config.delta_t_on);
+      success &= maybeUpdateFloat(configObj, _delta_t_off_ref, config.delta_t_off);
+      success &= maybeUpdateFloat(configObj, _min_t_on_ref, config.min_t_on);
+      success &= maybeUpdateInt(configObj, _oversample_ref, config.oversample);
+
+      // Settings added after the initial deployment are optional.  If missing, the defaults
+      // hardcoded above are used without failing the update.
+      maybeUpdateInt(configObj, _revision_ref, config.revision);
+      maybeUpdateInt(configObj, _stats_window_ref, config.stats_window);
+      maybeUpdateInt(configObj, _stats_long_window_ref, config.stats_long_window);
+      maybeUpdateFloat(configObj, _target_std_err_ref, config.target_std_err);
+      maybeUpdateInt(configObj, _min_oversample_ref, config.min_oversample);
+      maybeUpdateInt(configObj, _burst_ref, config.burst);
+      maybeUpdateInt(configObj, _mux_settle_micros_ref, config.mux_settle_micros);
+      maybeUpdateChars(configObj, _filter_ref, config.filter, sizeof(config.filter));
+      maybeUpdateInt(configObj, _trim_percent_ref, config.trim_percent);
+      maybeUpdateFloat(configObj, _hampel_threshold_ref, config.hampel_threshold);
+      maybeUpdateInt(configObj, _channels_ref, config.channels);
+      maybeUpdateInt(configObj, _polling_min_milliseconds_ref, config.polling_min_milliseconds);
+      maybeUpdateInt(configObj, _polling_max_milliseconds_ref, config.polling_max_milliseconds);
+      maybeUpdateInt(configObj, _upload_every_ref, config.upload_every);
+      maybeUpdateFloat(configObj, _compression_deviation_ref, config.compression_deviation);
+      maybeUpdateInt(configObj, _deep_sleep_seconds_ref, config.deep_sleep_seconds);
+      maybeUpdateInt(configObj, _deep_sleep_upload_every_ref, config.deep_sleep_upload_every);
+      maybeUpdateFloat(configObj, _deep_sleep_margin_ref, config.deep_sleep_margin);
+      maybeUpdateInt(configObj, _log_level_ref, config.log_level);
+
+      // Apply any per-channel overrides of the thermistor parameters.
+      applySharedThermistorConfig(config);
+      if (!configObj.getJsonVariant(_thermistors_ref).success()) {
+        LOGLN(CLOUD, INFO, F("  (No '"), _thermistors_ref, F("', using shared thermistor parameters.)"));
+      } else {
+        int channels = config.channels < 2
+          ? 2
+          : config.channels > Device::_max_channels
+            ? Device::_max_channels
+            : config.channels;
+        for (int channel = 0; channel < channels; channel++) {
+          String prefix = String(_thermistors_ref) + "/" + channel + "/";
+          ThermistorConfig& thermistor = config.thermistors[channel];
+          maybeUpdateFloat(configObj, (prefix + _series_resistor_ref).c_str(), thermistor.series_resistor);
+          maybeUpdateFloat(configObj, (prefix + _resistance_at_0_ref).c_str(), thermistor.resistance_at_0);
+          maybeUpdateFloat(configObj, (prefix + _temperature_at_0_ref).c_str(), thermistor.temperature_at_0);
+          maybeUpdateFloat(configObj, (prefix + _b_coefficient_ref).c_str(), thermistor.b_coefficient);
+          maybeUpdateFloat(configObj, (prefix + _compression_deviation_ref).c_str(), thermistor.compression_deviation);
+        }
+      }
+
       // Stop blinking the LED.
       device.setLed(true);
 
-      return success;
+      if (!success) {
+        LOGLN(CLOUD, WARN, F("Cloud config is incomplete, keeping the current config."));
+        return false;
+      }
+
+      // Reject values that would fail an assert (or divide by zero) when applied, rather than
+      // caching them in flash where they would be applied on every boot.
+      if (!isValid(config)) {
+        LOGLN(CLOUD, ERROR, F("Cloud config is invalid, keeping the current config."));
+        return false;
+      }
+
+      _config = config;
+      return true;
+    }
+
+    // Replaces the current config with the copy cached in flash by 'saveCached()', if any.
+    // Used at boot so that the device can operate with its last known config before (or
+    // without) connecting to Firebase.  Returns false if there is no valid cached config.
+    bool loadCached(LocalStorage& localStorage) {
+      TRACE_SCOPE(LoadCachedConfig);
+      LOG(CLOUD, INFO, F("Loading cached cloud config: "));
+      Config cached;
+      if (!localStorage.loadRecord(_cache_record_name, _config_version, cached)) {
+        LOGLN(CLOUD, INFO, F("(none, using defaults)"));
+        return false;
+      }
+
+      // (Cached by an earlier firmware that did not validate configs before caching them.)
+      if (!isValid(cached)) {
+        LOGLN(CLOUD, WARN, F("(invalid, using defaults)"));
+        return false;
+      }
+
+      _config = cached;
+      LOGLN(CLOUD, INFO, F("revision "), _config.revision);
+      return true;
+    }
+
+    // Caches the current config in flash if it differs from the cached copy.  (The config
+    // retrieved from Firebase is authoritative, so that the cache always holds the config the
+    // device last ran, but flash is not rewritten on every boot.)
+    void saveCached(LocalStorage& localStorage) {
+      Config cached;
+      if (localStorage.loadRecord(_cache_record_name, _config_version, cached)
+        && memcmp(&cached, &_config, sizeof(_config)) == 0) {
+        return;
+      }
+
+      LOG(CLOUD, INFO, F("Caching cloud config revision "), _config.revision, F(": "));
+      bool saved = localStorage.saveRecord(_cache_record_name, _config_version, _config);
+      LOGLN(CLOUD, INFO, saved ? F("[OK]") : F("[FAILED]"));
     }
 
     // Initializes connection to Firebase database.
     bool init(const String& firebase_host, const String& firebase_auth) {
-      Serial.print("Conecting to Firebase '"); Serial.print(firebase_host); Serial.print("': ");
+      LOG(CLOUD, INFO, F("Conecting to Firebase '"), firebase_host, F("': "));
 
       Firebase.begin(firebase_host, firebase_auth);
 
       // Note: In v0.1.0 of the firebase-arduino library, 'Firebase.begin()' appears to succeed
       //       even when the Firebase is inaccessible, etc.  (i.e., the below always prints '[OK]').
       if (!failed()) {
-        Serial.println("[OK]");
+        LOGLN(CLOUD, INFO, F("[OK]"));
       }
     }
 
     // Log the given sample to the next available slot in Firebase.
-    void log(Device& device, time_t timestamp, double adc0, double adc1, bool active) {
-      // Build a JsonObject containing all the sample information.
+    void log(Device& device, const Sample& sample) {
+      TRACE_SCOPE(CloudLog);
+
       DynamicJsonBuffer _json_buffer;
       JsonObject& root = _json_buffer.createObject();
-      root["time"] = timestamp;
-      root["0"] = adc0;
-      root["1"] = adc1;
-      root["active"] = active;
+      setSample(root, sample);
 
       // Calculate the Firebase ref to the next log entry to write.
       String slotRef = _log_ref + "/" + _current_entry;
 
-      Serial.print("  Logging '"); Serial.print(slotRef); Serial.print("': ");
+      if (write(device, slotRef, root)) {
+        // If we successfully logged the value, advance _current_entry to the next slot.
+        // (Note that the log wraps at 'max_entries'.)  The logged values were already
+        // printed when the sample was taken.
+        LOG_TOKEN(CLOUD, INFO, LogToken::CloudLogged, _current_entry, sample.time);
+        _current_entry = (_current_entry + 1) % _config.max_entries;
+        _logged_metric.inc();
+      }
+    }
 
-      // Make three attempts to write the sample to log, and then give up.
+    // Log the given event (with the sample in which it was detected) to the next available
+    // slot of the events log in Firebase.  Returns false if the event could not be logged.
+    bool logEvent(Device& device, const Event& event) {
+      TRACE_SCOPE(CloudLog);
+
+      DynamicJsonBuffer _json_buffer;
+      JsonObject& root = _json_buffer.createObject();
+      setSample(root, event.sample);
+      root["event"] = EventQueue::nameOf(event.type);
+
+      String slotRef = _events_ref + "/" + _current_event;
+
+      if (!write(device, slotRef, root)) {
+        return false;
+      }
+
+      LOGLN(CLOUD, INFO, F("Logged event '"), EventQueue::nameOf(event.type), F("' to "), slotRef);
+      _current_event = (_current_event + 1) % _config.max_entries;
+      _events_logged_metric.inc();
+      return true;
+    }
+
+  private:
+    // Sets the fields of a log entry from 'sample'.  Each channel's ADC value is keyed by its
+    // channel number.
+    void setSample(JsonObject& root, const Sample& sample) {
+      // (The timestamp is logged in seconds, with a millisecond fraction.)
+      root.set("time", sample.time + sample.millis / 1000.0, /* decimals = */ 3);
+      for (int channel = 0; channel < sample.channels; channel++) {
+        root[String(channel)] = sample.adc[channel];
+      }
+      root["active"] = sample.active;
+    }
+
+    // Makes three attempts to write 'root' to 'slotRef', and then gives up.  Returns true if
+    // an attempt succeeded.
+    bool write(Device& device, const String& slotRef, JsonObject& root) {
       for (int i = 0; i < 3; i++) {
+        if (i > 0) {
+          _log_retries_metric.inc();
+        }
+
         // Rapidly blink the LED to indicate that network activity is in progress.
         device.blinkLed(19);
         
+        uint32_t started = millis();
         Firebase.set(slotRef, root);
+        _log_seconds_metric.observe((millis() - started) / 1000.0f);
 
         // Stop blinking the LED.
         device.setLed(true);
 
         if (!failed()) {
-          // If we successfully logged the value, pretty print it and advance _current_entry
-          // to the next slot.  (Note that the log wraps at '_max_entries'.)
-          root.printTo(Serial); Serial.println();
-          _current_entry = (_current_entry + 1) % _max_entries;
-
-          break;  // Terminate the loop on success.
+          return true;
         }
 
         // Otherwise, a short delay before retrying a failed attempt.
-        Serial.print("  ... ");
+        LOGLN(CLOUD, WARN, F("  Logging '"), slotRef, F("' ... "));
         delay(100);        
       }
+
+      _log_failures_metric.inc();
+      return false;
     }
 };
 
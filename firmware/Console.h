@@ -0,0 +1,156 @@
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+/*
+ * Console.h - Line-oriented commands typed into the serial monitor.
+ *
+ * 'poll()' (called from the main loop's 'wait()') reads whatever input has arrived without
+ * blocking and, at the end of each line, splits the line into whitespace separated words
+ * in place and runs the matching command from the table passed to 'begin()'.  Nothing is
+ * allocated: the line is held in a fixed buffer and the words are pointers into it.
+ *
+ * The command table, and each command's name and usage, are kept in flash.  (See
+ * CONSOLE_STRINGS() and CONSOLE_COMMAND().)
+ *
+ * Commands print their output to '_log', which writes through (blocking) while a command
+ * runs so that long output (e.g., metrics) is not discarded when it exceeds the log's ring.
+ * Commands therefore should not be used while timing matters.
+ *
+ * (The serial monitor must send a line ending, e.g., 'Newline' in the Arduino IDE.)
+ */
+
+#include <string.h>
+#include <pgmspace.h>
+#include <HardwareSerial.h>
+#include "Log.h"
+
+class Console {
+  public:
+    // Maximum number of words in a command line, including the command.
+    static const uint8_t _max_args = 4;
+
+    // Runs a command.  'argv[0]' is the command name.
+    typedef void (*Handler)(uint8_t argc, char* argv[]);
+
+    // (The table of commands passed to 'begin()' must be in PROGMEM, as must the strings.)
+    struct Command {
+      PGM_P name;
+      PGM_P usage;                            // Arguments and description shown by 'printHelpTo()'
+      Handler run;
+    };
+
+  private:
+    static const uint8_t _max_line = 80;
+
+    char _line[_max_line + 1];
+    uint8_t _length = 0;
+    bool _overflow = false;                   // True if the current line exceeded '_max_line'
+
+    const Command* _commands = nullptr;       // (In PROGMEM)
+    uint8_t _count = 0;
+
+    // Copies the command at 'index' out of flash.
+    Command commandAt(uint8_t index) const {
+      Command command;
+      memcpy_P(&command, &_commands[index], sizeof(command));
+      return command;
+    }
+
+    static const __FlashStringHelper* flash(PGM_P string) {
+      return reinterpret_cast<const __FlashStringHelper*>(string);
+    }
+
+    // Splits '_line' into words in place.  Returns the number of words.  (Words beyond
+    // '_max_args' are ignored.)
+    uint8_t tokenize(char* argv[]) {
+      uint8_t argc = 0;
+      char* cursor = _line;
+      while (argc < _max_args) {
+        while (*cursor == ' ' || *cursor == '\t') {
+          cursor++;
+        }
+        if (*cursor == '\0') {
+          break;
+        }
+
+        argv[argc++] = cursor;
+        while (*cursor != '\0' && *cursor != ' ' && *cursor != '\t') {
+          cursor++;
+        }
+        if (*cursor != '\0') {
+          *cursor++ = '\0';
+        }
+      }
+      return argc;
+    }
+
+    void execute() {
+      char* argv[_max_args];
+      uint8_t argc = tokenize(argv);
+      if (argc == 0) {
+        return;
+      }
+
+      for (uint8_t i = 0; i < _count; i++) {
+        Command command = commandAt(i);
+        if (strcmp_P(argv[0], command.name) == 0) {
+          _log.setAsync(false);
+          command.run(argc, argv);
+          _log.setAsync(true);
+          return;
+        }
+      }
+
+      _log.print(F("Unknown command '")); _log.print(argv[0]); _log.println(F("'.  (Type 'help' for a list of commands.)"));
+    }
+
+  public:
+    void begin(const Command* commands, uint8_t count) {
+      _commands = commands;
+      _count = count;
+    }
+
+    // Reads any pending input and runs each completed line.  (Call frequently from the main loop.)
+    void poll() {
+      while (Serial.available() > 0) {
+        char c = Serial.read();
+
+        if (c == '\r' || c == '\n') {
+          _line[_length] = '\0';
+          if (_overflow) {
+            _log.print(F("Command exceeds ")); _log.print(_max_line); _log.println(F(" characters."));
+          } else {
+            execute();
+          }
+          _length = 0;
+          _overflow = false;
+        } else if (c == '\b' || c == 0x7F) {
+          if (_length > 0) {
+            _length--;
+          }
+        } else if (_length < _max_line) {
+          _line[_length++] = c;
+        } else {
+          _overflow = true;
+        }
+      }
+    }
+
+    // Prints each command with its usage.
+    void printHelpTo(Print& out) const {
+      for (uint8_t i = 0; i < _count; i++) {
+        Command command = commandAt(i);
+        out.print(F("  ")); out.print(flash(command.name)); out.print(' '); out.println(flash(command.usage));
+      }
+    }
+};
+
+// Defines the name and usage strings of command 'name' in flash.  (Use at namespace scope,
+// followed by CONSOLE_COMMAND(name, handler) in the table passed to 'Console::begin()'.)
+#define CONSOLE_STRINGS(name, usage)                                    \
+  static const char _console_name_##name[] PROGMEM = #name;             \
+  static const char _console_usage_##name[] PROGMEM = usage;
+
+#define CONSOLE_COMMAND(name, handler)  { _console_name_##name, _console_usage_##name, handler }
+
+#endif // __CONSOLE_H__
@@ -0,0 +1,45 @@
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+/*
+ * Crc32.h - CRC-32 (IEEE 802.3, as used by zlib/PNG) for detecting corrupted records in flash.
+ *
+ * Computed bitwise rather than with a 1KB lookup table, as it is only used on records of a
+ * few hundred bytes when loading/saving configuration.
+ * (See https://en.wikipedia.org/wiki/Cyclic_redundancy_check)
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Crc32 {
+  private:
+    // Reversed representation of the CRC-32 polynomial.
+    static const uint32_t _polynomial = 0xEDB88320;
+
+  public:
+    // Initial value for 'update()'.
+    static const uint32_t _initial = 0;
+
+    // Returns the CRC of the bytes preceding 'data' (summarized by 'crc') followed by the
+    // 'length' bytes of 'data'.  (Chain calls to checksum non-contiguous data.)
+    static uint32_t update(uint32_t crc, const void* data, size_t length) {
+      const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+      crc = ~crc;
+      while (length--) {
+        crc ^= *bytes++;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+          crc = (crc >> 1) ^ (_polynomial & (0 - (crc & 1)));
+        }
+      }
+      return ~crc;
+    }
+
+    // Returns the CRC of the 'length' bytes of 'data'.
+    static uint32_t of(const void* data, size_t length) {
+      return update(_initial, data, length);
+    }
+};
+
+#endif // __CRC32_H__
@@ -0,0 +1,230 @@
+#ifndef __DEEP_SLEEP_H__
+#define __DEEP_SLEEP_H__
+
+/*
+ * DeepSleep.h - Duty-cycled operation while the collector is idle (e.g., overnight.)
+ *
+ * While the relay is open and the collector is well below the temperature at which it would
+ * engage, the device can deep sleep between samples instead of idling with the radio on.
+ * Each wake takes a single sample with the radio disabled and appends it to a small batch
+ * kept in RTC user memory (which survives deep sleep.)  Every 'deepSleepUploadEvery' wakes, the
+ * device wakes with the radio enabled, boots normally, uploads the batch and, if conditions
+ * are still idle, returns to sleep.  If a wake finds that the collector should engage (or
+ * conditions are no longer idle) it also boots normally and resumes continuous polling.
+ *
+ * Requirements and caveats:
+ *
+ *    - GPIO16 (D0) must be connected to RST for the RTC timer to wake the ESP8266.
+ *    - GPIOs are high impedance while asleep, so the relay driver is undriven (i.e., open.)
+ *      This is why the device only sleeps while the relay is open.
+ *    - The clock is carried across sleeps by adding the requested sleep time, as there is no
+ *      NTP on radio-off wakes.  The RTC timer drifts by up to a few percent, so timestamps of
+ *      batched samples may be off by a few seconds.  The clock is resynchronized with NTP on
+ *      each upload wake.
+ *
+ * 'printEnergyTo()' estimates the average current draw from the time spent in each power
+ * state, using typical figures for the ESP8266 (see '_radio_on_ma', etc.)
+ */
+
+#include <Esp.h>
+#include <TimeLib.h>
+#include <user_interface.h>
+#include "Crc32.h"
+#include "Device.h"
+#include "DoubleReset.h"
+#include "SampleHistory.h"
+#include "Log.h"
+
+class DeepSleep {
+  public:
+    // The maximum number of samples batched in RTC memory between uploads.
+    static const uint8_t _max_batch = 12;
+
+  private:
+    // Offset (in 4 byte blocks) of 'RtcState' in RTC user memory.  (Follows the marker used
+    // by 'DoubleReset'.)
+    static const uint32_t _rtc_offset = 34;
+    static const uint32_t _rtc_blocks = 128;
+
+    static const uint32_t _rtc_magic = 0x534c5045;    // 'SLPE'
+
+    // Typical current draw (in milliamps) in each power state, used for the energy estimate.
+    static constexpr float _radio_on_ma = 70;         // Awake, WiFi associated (the always-on baseline)
+    static constexpr float _radio_off_ma = 15;        // Awake, RF disabled
+    static constexpr float _asleep_ma = 0.02;         // Deep sleep (ESP8266 only, excludes regulator, etc.)
+
+    // A sample as stored in RTC memory.  ADC values are fixed point with 6 fractional bits.
+    // (Timestamps are only kept to the second, as the clock is estimated while asleep.)
+    struct BatchedSample {
+      uint32_t time;
+      uint16_t adc[Device::_max_channels];
+    };
+
+    // State preserved across deep sleep.  ('crc' covers everything following it.)
+    struct RtcState {
+      uint32_t magic;
+      uint32_t crc;
+      uint64_t radio_on_millis;         // Total time awake with the radio enabled
+      uint64_t radio_off_millis;        // Total time awake with the radio disabled
+      uint64_t asleep_millis;           // Total time in deep sleep
+      uint32_t time;                    // Estimated UTC time at wake ('now()' at sleep + sleep time)
+      uint32_t wakes;                   // Number of wakes from deep sleep
+      uint8_t  stable;                  // Consecutive idle samples (see 'update()')
+      uint8_t  radio_on;                // True if the current wake has the radio enabled
+      uint8_t  channels;                // Number of channels in the batched samples
+      uint8_t  count;                   // Number of batched samples
+      uint8_t  below_minimum;           // True if a temperature was below 'minTOn' (see 'setBelowMinimum()')
+      uint8_t  reserved[3];
+      BatchedSample batch[_max_batch];
+    };
+
+    static_assert(sizeof(RtcState) % 4 == 0, "RTC memory is accessed in 4 byte blocks.");
+    static_assert(_rtc_offset * 4 + sizeof(RtcState) <= _rtc_blocks * 4, "RtcState exceeds RTC user memory.");
+
+    RtcState _state;
+    bool _resumed = false;              // True if '_state' was restored by 'resume()'
+
+    static uint32_t crcOf(const RtcState& state) {
+      const uint8_t* start = reinterpret_cast<const uint8_t*>(&state.crc) + sizeof(state.crc);
+      return Crc32::of(start, reinterpret_cast<const uint8_t*>(&state + 1) - start);
+    }
+
+  public:
+    DeepSleep() {
+      memset(&_state, 0, sizeof(_state));
+      _state.radio_on = true;
+    }
+
+    // Restores the state saved by 'sleep()' if the device has just woken from deep sleep
+    // (including the estimated time, which is set on the 'Time' library.)  Returns false
+    // on any other boot (e.g., power on, reset, crash), in which case any batched samples
+    // and energy statistics are discarded.
+    bool resume() {
+      if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE) {
+        return false;
+      }
+
+      RtcState state;
+      ESP.rtcUserMemoryRead(_rtc_offset, reinterpret_cast<uint32_t*>(&state), sizeof(state));
+      if (state.magic != _rtc_magic || state.crc != crcOf(state)) {
+        LOGLN(POWER, WARN, F("Deep sleep state in RTC memory is invalid, discarding."));
+        return false;
+      }
+
+      _state = state;
+      _state.wakes++;
+      setTime(_state.time);
+      _resumed = true;
+
+      LOGLN(POWER, INFO, F("Woke from deep sleep (wake "), _state.wakes,
+        F(", radio "), _state.radio_on ? F("on") : F("off"),
+        F(", batched: "), _state.count, F(")"));
+      return true;
+    }
+
+    bool isResumed() const    { return _resumed; }
+    bool isRadioOn() const    { return _state.radio_on; }
+    uint8_t count() const     { return _state.count; }
+
+    // Whether a temperature was below 'minTOn' when last sampled.  Carried across deep sleep so
+    // that the 'BelowMinimum' event is only raised when a temperature falls below 'minTOn'.
+    bool isBelowMinimum() const           { return _state.below_minimum; }
+    void setBelowMinimum(bool below)      { _state.below_minimum = below; }
+
+    // Records whether the latest sample was idle (relay open and the collector well below the
+    // temperature at which it would engage.)  Returns the number of consecutive idle samples.
+    uint8_t update(bool idle) {
+      _state.stable = idle
+        ? (_state.stable < 255 ? _state.stable + 1 : 255)
+        : 0;
+      return _state.stable;
+    }
+
+    // Appends 'sample' to the batch.  Returns false if the batch is full.
+    bool add(const Sample& sample) {
+      if (_state.count >= _max_batch) {
+        return false;
+      }
+
+      BatchedSample& batched = _state.batch[_state.count++];
+      batched.time = sample.time;
+      for (int channel = 0; channel < sample.channels; channel++) {
+        float adc = sample.adc[channel] * 64;
+        batched.adc[channel] = adc < 0 ? 0 : adc > 0xFFFF ? 0xFFFF : static_cast<uint16_t>(adc + 0.5);
+      }
+      _state.channels = sample.channels;
+      return true;
+    }
+
+    // Restores the time and ADC values of the batched sample at 'index'.  (The caller converts
+    // the ADC values to temperatures.  Batched samples were only taken while the relay was open.)
+    void get(uint8_t index, Sample& sample) const {
+      assert(index < _state.count);
+
+      const BatchedSample& batched = _state.batch[index];
+      sample.time = batched.time;
+      sample.millis = 0;
+      sample.channels = _state.channels;
+      for (int channel = 0; channel < _state.channels; channel++) {
+        sample.adc[channel] = batched.adc[channel] / 64.0;
+        sample.rejected[channel] = 0;
+      }
+      sample.active = false;
+    }
+
+    // Discards the batch (i.e., once uploaded.)
+    void clear() {
+      _state.count = 0;
+    }
+
+    // Saves the state to RTC memory and enters deep sleep for 'seconds'.  The next wake has the
+    // radio enabled only if 'radioOnWake' is true.  Does not return.
+    void sleep(uint32_t seconds, bool radioOnWake) {
+      uint32_t awake = millis();
+      if (_state.radio_on) {
+        _state.radio_on_millis += awake;
+      } else {
+        _state.radio_off_millis += awake;
+      }
+      _state.asleep_millis += seconds * 1000;
+
+      _state.time = now() + seconds;
+      _state.radio_on = radioOnWake;
+      _state.magic = _rtc_magic;
+      _state.crc = crcOf(_state);
+      ESP.rtcUserMemoryWrite(_rtc_offset, reinterpret_cast<uint32_t*>(&_state), sizeof(_state));
+
+      LOGLN(POWER, INFO, F("Entering deep sleep for "), seconds,
+        F("s (radio "), radioOnWake ? F("on") : F("off"), F(" at wake.)"));
+
+      // A reset while asleep is a single press, even if the double reset window is still open.
+      DoubleReset::clear();
+
+      // Transmit everything still buffered (e.g., the energy report), which is otherwise lost
+      // with RAM.
+      _log.drainAll();
+
+      ESP.deepSleep(static_cast<uint64_t>(seconds) * 1000000, radioOnWake ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+    }
+
+    // Prints the time spent in each power state since the device last booted normally, and
+    // the resulting estimated average current compared with remaining awake with the radio on.
+    void printEnergyTo(Print& out) const {
+      // Include the current wake.
+      uint64_t radioOn = _state.radio_on_millis + (_state.radio_on ? millis() : 0);
+      uint64_t radioOff = _state.radio_off_millis + (_state.radio_on ? 0 : millis());
+      uint64_t asleep = _state.asleep_millis;
+      float total = static_cast<float>(radioOn + radioOff + asleep);
+
+      float averageMa = (radioOn * _radio_on_ma + radioOff * _radio_off_ma + asleep * _asleep_ma) / total;
+
+      out.print(F("Power: radio on ")); out.print(static_cast<uint32_t>(radioOn / 1000));
+      out.print(F("s, radio off ")); out.print(static_cast<uint32_t>(radioOff / 1000));
+      out.print(F("s, asleep ")); out.print(static_cast<uint32_t>(asleep / 1000));
+      out.print(F("s.  Estimated average ")); out.print(averageMa);
+      out.print(F("mA vs. ")); out.print(_radio_on_ma);
+      out.print(F("mA always on (")); out.print(100 * (1 - averageMa / _radio_on_ma)); out.println(F("% saved)"));
+    }
+};
+
+#endif // __DEEP_SLEEP_H__
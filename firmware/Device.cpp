@@ -1,53 +1,152 @@
 #include <arduino.h>
 #include <assert.h>
 #include "Device.h"
+#include "Log.h"
+#include "Trace.h"
 
 /*
  * Device.cpp - (See description in Device.h)
  */
 
-// Explicit conversion from bool -> HIGH/LOW.
-/* static */ uint32_t Device::boolToDigital(bool state) {
-  return state ? HIGH : LOW;
+// Drives the mux select lines for 'channel' without waiting for the output to settle.
+void Device::setMux(int channel) {
+  assert(0 <= channel && channel < _max_channels);
+
+  // Bits 0..2 of 'channel' drive S0..S2.
+  MuxBus::write(channel);
+
+  _selected_channel = channel;
+  _mux_switches++;
 }
 
-// Explicit from HIGH/LOW -> bool.
-/* static */ bool Device::digitalToBool(uint32_t state) {
-  assert(state == HIGH || state == LOW);
-  return state != LOW;
+// Selects the mux input specified by 'channel'.  This mux output connects to the
+// A0 analog pin of the ESP8266.  Does nothing if 'channel' is already selected, so
+// consecutive reads of the same channel do not pay the settling time.
+void Device::selectAdc(int channel) {
+  if (channel == _selected_channel) {
+    return;
+  }
+
+  setMux(channel);
+
+  // 74HC4051 rise/fall rate max 139ns/V @ 4.5v Vcc, but the RC time constant of the
+  // divider and A0's input network dominates.  (See 'calibrateSettling()'.)
+  delayMicroseconds(_settle_micros);
 }
 
-// Negates the current value of the give 'pin'.
-/* static */ bool Device::negateDigital(uint32_t pin) {
-  bool newState = !digitalToBool(digitalRead(pin));
-  digitalWrite(pin, boolToDigital(newState));
-  return newState;
+// Overrides the time allowed for the mux output to settle after switching channels.
+void Device::setSettleMicros(uint32_t micros) {
+  _settle_micros = micros > _max_settle_micros
+    ? _max_settle_micros
+    : micros;
 }
 
-// Selects the mux input specified by 'channel'.  This mux output connects to the
-// A0 analog pin of the ESP8266.
-void Device::selectAdc(int channel) const {
-  assert(0 <= channel && channel <= 1);
+// Returns the ADC value of 'channel' after allowing the maximum settling time.
+int Device::readSettled(int channel) {
+  setMux(channel);
+  delayMicroseconds(_max_settle_micros);
+  return analogRead(_thermistor_adc_pin);
+}
 
-  digitalToBool(digitalRead(0));
+// Returns the time (in microseconds) from switching the mux from 'from' to 'to' until
+// the end of the first ADC read that agrees with the fully settled value of 'to'.
+uint32_t Device::measureSettling(int from, int to) {
+  // Tolerance (in LSBs) for a read to be considered settled.
+  const int tolerance = 2;
+
+  // Establish the fully settled value of 'to'.
+  int settled = readSettled(to);
+
+  // Switch away and back again, timing how long the reading takes to converge.  (The time is
+  // taken after each read, as the read itself samples the settling input.)
+  readSettled(from);
+
+  setMux(to);
+  uint32_t start = micros();
+  uint32_t elapsed;
+  int reading;
+  do {
+    reading = analogRead(_thermistor_adc_pin);
+    elapsed = micros() - start;
+  } while (abs(reading - settled) > tolerance && elapsed < _max_settle_micros);
+
+  return elapsed;
+}
 
-  bool s0_active = (channel & 0x01) != 0;
-  digitalWrite(_thermistor_mux_s0_pin, boolToDigital(s0_active));
+// Measures how long the mux output takes to settle when switching between channels 0 and 1
+// (the pool and collector thermistors, which are always present) in either direction
+// and sets the settling time to twice the worst case observed (plus a small margin to
+// cover the ~100us resolution of 'analogRead()'.)  Returns the new settling time.
+//
+// If the two channels read too closely to observe settling (e.g., the pool and collector
+// are at similar temperatures), keeps the maximum settling time instead.  (Leaves channel
+// 0 selected.)
+uint32_t Device::calibrateSettling() {
+  const int trials = 4;
+
+  int step = abs(readSettled(1) - readSettled(0));
+  if (step < _min_calibration_step) {
+    LOG(DEVICE, INFO, F("(skipped, channels 0 and 1 differ by "), step, F(" LSB) "));
+    setSettleMicros(_max_settle_micros);
+    return _settle_micros;
+  }
+
+  uint32_t worst = 0;
+  for (int i = 0; i < trials; i++) {
+    worst = max(worst, measureSettling(0, 1));
+    worst = max(worst, measureSettling(1, 0));
+  }
+
+  setSettleMicros(2 * worst + 20);
+  return _settle_micros;
+}
+
+// Sets the state of the relay (true -> closed/energized, false -> open/default).  Records
+// the time and count of transitions for wear statistics.
+void Device::setRelay(bool closed) {
+  RelayPin::write(closed);
+
+  if (closed == _relay_closed) {
+    return;
+  }
 
-  // 74HC4051 rise/fall rate max 139ns/V @ 4.5v Vcc
-  delay(1);
+  uint32_t now = millis();
+  if (_relay_closed) {
+    _relay_closed_millis += now - _relay_changed_millis;
+  }
+
+  _relay_closed = closed;
+  _relay_changed_millis = now;
+  _relay_transitions++;
 }
 
-// Sets the state of the relay (true -> closed/energized, false -> open/default).
-void Device::setRelay(bool closed) const {
-  // We negate 'closed' below because the design uses a low-side relay driver that engages
-  digitalWrite(_relay_pin, boolToDigital(closed));
+// Gets the total time (in milliseconds) the relay has been closed since boot, including
+// the current interval if the relay is presently closed.
+uint32_t Device::getRelayClosedMillis() const {
+  return _relay_closed
+    ? _relay_closed_millis + (millis() - _relay_changed_millis)
+    : _relay_closed_millis;
 }
 
-// Gets the current state of the relay (true -> closed/energized, false -> open/default).
-bool Device::getRelay() const {
-  // We negate 'closed' below because the design uses a low-side relay driver that engages
-  return digitalToBool(digitalRead(_relay_pin));
+// At most once per '_relay_verify_millis', reads back the relay pin and compares it with
+// the last state passed to 'setRelay()'.  On a mismatch, counts a fault and re-drives the
+// pin.  Returns false if a mismatch was detected.
+bool Device::verifyRelay() {
+  uint32_t now = millis();
+  if (now - _relay_verified_millis < _relay_verify_millis) {
+    return true;
+  }
+  _relay_verified_millis = now;
+
+  if (RelayPin::read() == _relay_closed) {
+    return true;
+  }
+
+  _relay_faults++;
+  RelayPin::write(_relay_closed);
+
+  LOG_TOKEN(DEVICE, ERROR, LogToken::RelayFault, _relay_closed ? F("closed") : F("open"), _relay_faults);
+  return false;
 }
 
 // Sets the state of the built-in blue LED on the ESP8266.
@@ -55,12 +154,12 @@ void Device::setLed(bool on) {
   // Setting the LED state implicitly halts any previous calls to blinkLed().
   _led_ticker.detach();
   
-  digitalWrite(_blue_led_pin, boolToDigital(!on));
+  LedPin::write(!on);
 }
 
 // Toggles the current state of the built-in blue LED on the ESP8266.
 /* static */ bool Device::toggleLed() {
-  return negateDigital(_blue_led_pin);
+  return LedPin::toggle();
 }
 
 // Blinks the built-in blue LED on the ESP8266 at the specified rate.  (Call 'setLed()' to
@@ -70,19 +169,28 @@ void Device::blinkLed(uint32_t rateInMilliseconds) {
 }
 
 // Samples the current value of the mux input specified by 'channel'.
-int Device::readAdc(int channel) const {
+int Device::readAdc(int channel) {
   selectAdc(channel);
   return analogRead(_thermistor_adc_pin);
 }
 
 // Sets the device to its inital state (relay open, LED on, MUX channel 0).
 void Device::init() {
+  TRACE_SCOPE(DeviceInit);
+
   pinMode(_relay_pin, OUTPUT);
   setRelay(false);
+  _relay_changed_millis = millis();
 
   pinMode(_blue_led_pin, OUTPUT);
   setLed(true);
 
   pinMode(_thermistor_mux_s0_pin, OUTPUT);
+  pinMode(_thermistor_mux_s1_pin, OUTPUT);
+  pinMode(_thermistor_mux_s2_pin, OUTPUT);
   selectAdc(0);
+
+  LOG(DEVICE, INFO, F("Calibrating mux settling time: "));
+  uint32_t settleMicros = calibrateSettling();
+  LOGLN(DEVICE, INFO, settleMicros, F("us"));
 }
@@ -9,15 +9,18 @@
  */
 
 #include <Ticker.h>
+#include "FastGpio.h"
 
 class Device {
   private:
     // LOW turns on the blue LED built into the ESP8266.
     static const uint32_t _blue_led_pin = 2;             // D4
     
-    // Controls which thermistor is connected to the ADC.  This GPIO pin is connected to the
-    // S0 pin of the 74HC4051 mux.
+    // Controls which thermistor is connected to the ADC.  These GPIO pins are connected to the
+    // S0, S1 and S2 pins of the 74HC4051 mux.
     static const uint32_t _thermistor_mux_s0_pin = 0;    // D3
+    static const uint32_t _thermistor_mux_s1_pin = 5;    // D1
+    static const uint32_t _thermistor_mux_s2_pin = 14;   // D5
 
     // Analog pin used to sample the current value of the thermistor.  Analog pin 0 is the
     // 'A0' pin of the Esp8266.  It's a coincidence it has the same ordinal index as the
@@ -28,22 +31,64 @@ class Device {
     // in the low-side relay driver.
     static const uint32_t _relay_pin = 4;                // D2
 
+    // Upper bound on the time allowed for the mux output to settle after switching channels.
+    // (This was the original fixed 'delay(1)'.)
+    static const uint32_t _max_settle_micros = 1000;
+
+    // Minimum difference (in LSBs) between the settled readings of channels 0 and 1 for their
+    // settling time to be measurable.  (Below this, the reading converges to within the
+    // tolerance of 'measureSettling()' almost immediately, regardless of the RC time constant.)
+    static const int _min_calibration_step = 50;
+
+    // Minimum interval between checks that the relay pin agrees with '_relay_closed'.
+    static const uint32_t _relay_verify_millis = 60 * 1000;
+
   public:
-    void setRelay(bool closed) const;
-    bool getRelay() const;
+    // The number of thermistor inputs on the 74HC4051 mux.
+    static const int _max_channels = 8;
+
+    void setRelay(bool closed);
+    bool getRelay() const { return _relay_closed; }
+    uint32_t getRelayTransitions() const { return _relay_transitions; }
+    uint32_t getRelayChangedMillis() const { return _relay_changed_millis; }
+    uint32_t getRelayClosedMillis() const;
+    uint32_t getRelayFaults() const { return _relay_faults; }
+    bool verifyRelay();
     void setLed(bool on);
     void blinkLed(uint32_t rateInMilliseconds);
-    int readAdc(int channel) const;
+    int readAdc(int channel);
+    uint32_t calibrateSettling();
+    void setSettleMicros(uint32_t micros);
+    uint32_t getSettleMicros() const { return _settle_micros; }
+    uint32_t getMuxSwitches() const { return _mux_switches; }
     void init();
 
   private:
-    static uint32_t boolToDigital(bool state);
-    static bool digitalToBool(uint32_t state);
-    static bool negateDigital(uint32_t pin);
+    // Direct register access to the GPIO pins above.  (Each pin's mode is set once with
+    // 'pinMode()' in 'init()'.)
+    typedef FastPin<_blue_led_pin> LedPin;
+    typedef FastPin<_relay_pin> RelayPin;
+    typedef FastBus<_thermistor_mux_s0_pin, _thermistor_mux_s1_pin, _thermistor_mux_s2_pin> MuxBus;
+
     static bool toggleLed();
-    void selectAdc(int channel) const;
+    void setMux(int channel);
+    void selectAdc(int channel);
+    int readSettled(int channel);
+    uint32_t measureSettling(int from, int to);
 
     Ticker _led_ticker;
+
+    int _selected_channel = -1;                           // Mux input currently selected (-1 if unknown)
+    uint32_t _settle_micros = _max_settle_micros;         // Delay after switching mux inputs
+    uint32_t _mux_switches = 0;                           // Number of times the mux input has changed
+
+    // Authoritative relay state.  The relay pin is only read back by 'verifyRelay()'.
+    bool _relay_closed = false;                           // Last state passed to 'setRelay()'
+    uint32_t _relay_changed_millis = 0;                   // 'millis()' when '_relay_closed' last changed
+    uint32_t _relay_transitions = 0;                      // Number of times '_relay_closed' has changed
+    uint32_t _relay_closed_millis = 0;                    // Total time closed, excluding the current interval
+    uint32_t _relay_verified_millis = 0;                  // 'millis()' of the last 'verifyRelay()' check
+    uint32_t _relay_faults = 0;                           // Number of times the pin disagreed with '_relay_closed'
 };
 
 #endif // __DEVICE_H__
@@ -0,0 +1,82 @@
+#ifndef __DOUBLE_RESET_H__
+#define __DOUBLE_RESET_H__
+
+/*
+ * DoubleReset.h - Detects the RESET button being pressed twice in quick succession.
+ *
+ * At boot, 'detect()' checks for a marker in the ESP8266's RTC user memory and then sets it.
+ * 'poll()' clears the marker once '_window_millis' has elapsed.  If the device is reset again
+ * before then, the next boot finds the marker and reports a double reset.
+ *
+ * RTC user memory survives a reset (and deep sleep), but not the loss of power, so unlike a
+ * sentinel file in flash, this neither delays boot nor wears the flash.  (Its contents are
+ * random after power on, so the marker is stored together with its complement.)
+ */
+
+#include <Esp.h>
+#include <user_interface.h>
+
+class DoubleReset {
+  private:
+    // Time after boot during which a second reset is detected as a double reset.
+    static const uint32_t _window_millis = 3000;
+
+    // Offset (in 4 byte blocks) of the marker in RTC user memory.  (Skips the first 128 bytes,
+    // which are used by the bootloader for OTA updates.)
+    static const uint32_t _rtc_offset = 32;
+
+    static const uint32_t _marker = 0xD0B1E5E7;
+
+    bool _armed = false;                // True while the marker is set (i.e., within the window)
+
+    static void writeMarker(uint32_t marker) {
+      uint32_t data[2] = { marker, ~marker };
+      ESP.rtcUserMemoryWrite(_rtc_offset, data, sizeof(data));
+    }
+
+  public:
+    // Returns true if the previous boot was reset within '_window_millis', and otherwise sets
+    // the marker so that a reset within the window is detected on the next boot.  (Call once
+    // during 'setup()'.)
+    bool detect() {
+      // Waking from deep sleep is not a button press.  The marker is not set, as the device may
+      // return to deep sleep before the window elapses (and a single press while asleep would
+      // then be detected as a double reset.)
+      if (ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE) {
+        writeMarker(0);
+        return false;
+      }
+
+      uint32_t data[2];
+      ESP.rtcUserMemoryRead(_rtc_offset, data, sizeof(data));
+      bool detected = data[0] == _marker && data[1] == ~_marker;
+
+      if (detected) {
+        writeMarker(0);
+        return true;
+      }
+
+      writeMarker(_marker);
+      _armed = true;
+      return false;
+    }
+
+    // Clears the marker once the window has elapsed.  (Call from the main loop.)
+    void poll() {
+      if (_armed && millis() >= _window_millis) {
+        writeMarker(0);
+        _armed = false;
+      }
+    }
+
+    // Clears the marker, closing the window early.  (Call before deep sleep, during which the
+    // window cannot be closed by 'poll()'.)
+    static void clear() {
+      writeMarker(0);
+    }
+
+    // True while a reset would be detected as a double reset.
+    bool isArmed() const { return _armed; }
+};
+
+#endif // __DOUBLE_RESET_H__
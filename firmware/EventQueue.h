@@ -0,0 +1,78 @@
+#ifndef __EVENT_QUEUE_H__
+#define __EVENT_QUEUE_H__
+
+/*
+ * EventQueue.h - Events waiting to be logged ahead of the batched samples.
+ *
+ * Routine samples are logged in batches of 'uploadEvery' (with the radio powered down in
+ * between.)  Events that someone may need to act on (e.g., the relay changing state, or the
+ * temperatures falling below 'minTOn') are instead queued here, and each is logged with its
+ * own request as soon as the radio is connected, ahead of any pending samples.
+ *
+ * The queue is a fixed capacity ring.  If it fills (e.g., while the network is down), the
+ * oldest event is discarded, so the most recent state is always logged.
+ */
+
+#include "SampleHistory.h"
+
+enum class EventType : uint8_t {
+  RelayClosed,                                // The collector was engaged
+  RelayOpened,                                // The collector was disengaged
+  BelowMinimum                                // A temperature fell below 'minTOn'
+};
+
+struct Event {
+  EventType type;
+  Sample    sample;                           // The sample in which the event was detected
+  uint32_t  queued_millis;                    // 'millis()' when the event was queued
+};
+
+class EventQueue {
+  public:
+    static const uint8_t _capacity = 4;
+
+  private:
+    Event    _events[_capacity];
+    uint8_t  _first = 0;                      // Index of the oldest event
+    uint8_t  _count = 0;                      // Number of queued events [0.._capacity]
+    uint32_t _dropped = 0;                    // Events discarded because the queue was full
+
+  public:
+    void push(EventType type, const Sample& sample) {
+      if (_count == _capacity) {
+        _first = (_first + 1) % _capacity;
+        _count--;
+        _dropped++;
+      }
+
+      _events[(_first + _count) % _capacity] = { type, sample, millis() };
+      _count++;
+    }
+
+    // Returns the oldest event.  (The queue must not be empty.)
+    const Event& front() const {
+      assert(_count > 0);
+      return _events[_first];
+    }
+
+    // Removes the oldest event.
+    void pop() {
+      assert(_count > 0);
+      _first = (_first + 1) % _capacity;
+      _count--;
+    }
+
+    bool isEmpty() const        { return _count == 0; }
+    uint8_t count() const       { return _count; }
+    uint32_t getDropped() const { return _dropped; }
+
+    static const char* nameOf(EventType type) {
+      return type == EventType::RelayClosed
+        ? "relayClosed"
+        : type == EventType::RelayOpened
+          ? "relayOpened"
+          : "belowMinimum";
+    }
+};
+
+#endif // __EVENT_QUEUE_H__
@@ -0,0 +1,100 @@
+#ifndef __FAST_GPIO_H__
+#define __FAST_GPIO_H__
+
+/*
+ * FastGpio.h - Reads/writes ESP8266 GPIO pins directly through the GPIO registers.
+ *
+ * 'digitalWrite()' and 'digitalRead()' validate the pin number, consult the pin's mode and
+ * (for writes) detach any PWM/waveform on every call.  For pins whose mode is configured
+ * once with 'pinMode()' at boot, a single store to the write-1-to-set/clear registers
+ * (GPOS/GPOC) or a load from the input register (GPI) is sufficient.
+ *
+ * The pin is a template parameter, so each mask is a compile time constant and every
+ * operation inlines to one or two instructions.  (tools/fastgpiobench.cpp compares these with
+ * 'digitalWrite()' against mocked registers.)  GPIO16 is not part of the GPOS/GPOC
+ * register bank, so 'FastPin<16>' falls back on 'digitalWrite()'/'digitalRead()'.
+ *
+ * (See the GPIO register definitions in the Esp8266 Arduino core's 'esp8266_peri.h'.)
+ */
+
+#include <Arduino.h>
+
+template <uint8_t Pin> class FastPin {
+  private:
+    static_assert(Pin < 16, "Only GPIO0..GPIO15 are mapped to GPOS/GPOC.");
+
+    static const uint32_t _mask = 1UL << Pin;
+
+  public:
+    static constexpr uint32_t mask()  { return _mask; }
+
+    // Drives the pin HIGH (true) or LOW (false).
+    static void write(bool high) {
+      if (high) {
+        GPOS = _mask;
+      } else {
+        GPOC = _mask;
+      }
+    }
+
+    // Reads the level currently present on the pin.
+    static bool read()              { return (GPI & _mask) != 0; }
+
+    // Reads the level the pin is being driven to (i.e., the output latch.)
+    static bool readOutput()        { return (GPO & _mask) != 0; }
+
+    // Inverts the level the pin is being driven to and returns the new level.
+    static bool toggle() {
+      bool high = !readOutput();
+      write(high);
+      return high;
+    }
+};
+
+// GPIO16 is controlled through the RTC register bank.  It is rarely toggled, so use the
+// Arduino core instead of duplicating its register access.
+template <> class FastPin<16> {
+  public:
+    static void write(bool high)    { digitalWrite(16, high ? HIGH : LOW); }
+    static bool read()              { return digitalRead(16) != LOW; }
+    static bool readOutput()        { return read(); }
+    static bool toggle() {
+      bool high = !readOutput();
+      write(high);
+      return high;
+    }
+};
+
+// Register bits of a list of pins corresponding to the set bits of a value, starting at bit
+// 'Bit' of the value.  (Recursion over the pins, so that the masks are compile time constants
+// and no loop or table remains at run time.  Instantiating 'FastPin<>' also rejects pins
+// outside GPIO0..GPIO15 at compile time.)
+template <uint8_t Bit, uint8_t... Pins> struct FastBusMask {
+  static constexpr uint32_t of(uint32_t /* value */) { return 0; }
+};
+
+template <uint8_t Bit, uint8_t Pin, uint8_t... Pins> struct FastBusMask<Bit, Pin, Pins...> {
+  static constexpr uint32_t of(uint32_t value) {
+    return (((value >> Bit) & 1) != 0 ? FastPin<Pin>::mask() : 0)
+      | FastBusMask<Bit + 1, Pins...>::of(value);
+  }
+};
+
+// Drives a group of GPIO0..GPIO15 pins to a binary value with one store to GPOS and one
+// store to GPOC, so that all pins change (nearly) simultaneously.  Bit 'i' of the value
+// is written to 'Pins[i]'.
+template <uint8_t... Pins> class FastBus {
+  private:
+    // Register bits of all pins in the bus.
+    static constexpr uint32_t _all = FastBusMask<0, Pins...>::of(0xFFFFFFFF);
+
+  public:
+    static void write(uint32_t value) {
+      uint32_t high = FastBusMask<0, Pins...>::of(value);
+
+      GPOS = high;
+      GPOC = _all & ~high;
+    }
+};
+
+#endif // __FAST_GPIO_H__
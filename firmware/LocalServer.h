@@ -0,0 +1,133 @@
+#ifndef __LOCAL_SERVER_H__
+#define __LOCAL_SERVER_H__
+
+/*
+ * LocalServer.h - Serves live telemetry directly from the device over the local network.
+ *
+ * Provides a low latency alternative to reading samples back from Firebase:
+ *
+ *    http://<device-ip>/samples[?count=N]  - JSON array of the most recent N samples held
+ *                                            in 'SampleHistory' (oldest first).
+ *    http://<device-ip>/stats              - JSON object with the short-term and long-term
+ *                                            rolling temperature statistics of the pool
+ *                                            and collector.  (See SampleHistory.h and
+ *                                            SAMPLE_HISTORY_STATS_CHANNELS.)
+ *    ws://<device-ip>:81/                  - Pushes each new sample as a JSON object the
+ *                                            moment it is taken.
+ *    http://<device-ip>/metrics            - Counters, gauges and histograms in the Prometheus
+ *                                            text format.  (See Metrics.h.)
+ *    http://<device-ip>/trace[?clear]      - Recorded trace events, if built with
+ *                                            TRACE_ENABLED=1.  (See Trace.h.)
+ *
+ * Samples use the same JSON shape as entries in the Firebase 'log', so dashboards can
+ * consume either source.
+ *
+ * Note: 'loop()' must be called frequently (see 'wait()' in firmware.ino) to service
+ *       pending HTTP requests and WebSocket connections.
+ */
+
+#include <ESP8266WebServer.h>
+#include <WebSocketsServer.h>
+#include <StreamString.h>
+#include "SampleHistory.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+class LocalServer {
+  private:
+    static const uint16_t _http_port = 80;
+    static const uint16_t _websocket_port = 81;
+
+    ESP8266WebServer _http { _http_port };
+    WebSocketsServer _websocket { _websocket_port };
+
+    const SampleHistory* _history = nullptr;
+
+    // Handles 'GET /samples'.  Returns the entire history if the optional 'count' argument
+    // is omitted.
+    void handleSamples() {
+      uint16_t count = _history->capacity();
+      if (_http.hasArg("count")) {
+        count = static_cast<uint16_t>(_http.arg("count").toInt());
+      }
+
+      StreamString body;
+      _history->printTo(body, count);
+      _http.send(200, "application/json", body);
+    }
+
+    // Handles 'GET /stats'.
+    void handleStats() {
+      StreamString body;
+      _history->printStatsTo(body);
+      _http.send(200, "application/json", body);
+    }
+
+    // Handles 'GET /metrics'.
+    void handleMetrics() {
+      StreamString body;
+      _metrics.printTo(body);
+      _http.send(200, "text/plain; version=0.0.4", body);
+    }
+
+#if TRACE_ENABLED
+    // Handles 'GET /trace'.  Clears the recorded events if the 'clear' argument is present,
+    // so that successive requests return successive windows of the main loop.
+    void handleTrace() {
+      StreamString body;
+      _trace.printTo(body);
+      if (_http.hasArg("clear")) {
+        _trace.clear();
+      }
+      _http.send(200, "text/plain", body);
+    }
+#endif
+
+  public:
+    // Registers request handlers and begins listening.  Must be called after WiFi is
+    // connected.
+    void init(const SampleHistory& history) {
+      _history = &history;
+
+      LOG(NETWORK, INFO, F("Starting local server: "));
+
+      _http.on("/samples", HTTP_GET, [this](){ handleSamples(); });
+      _http.on("/stats", HTTP_GET, [this](){ handleStats(); });
+      _http.on("/metrics", HTTP_GET, [this](){ handleMetrics(); });
+#if TRACE_ENABLED
+      _http.on("/trace", HTTP_GET, [this](){ handleTrace(); });
+#endif
+      _http.onNotFound([this](){ _http.send(404, "text/plain", "Not found"); });
+      _http.begin();
+
+      // Clients only receive samples, so incoming WebSocket messages are ignored.
+      _websocket.begin();
+      _websocket.onEvent([](uint8_t client, WStype_t type, uint8_t* payload, size_t length){ });
+
+      LOGLN(NETWORK, INFO, F("http://"), WiFi.localIP(), F("/samples, ws://"), WiFi.localIP(), F(":"), _websocket_port);
+    }
+
+    // Services pending HTTP requests and WebSocket traffic.
+    void loop() {
+      if (_history == nullptr) {
+        return;
+      }
+
+      _http.handleClient();
+      _websocket.loop();
+    }
+
+    // Pushes 'sample' to all connected WebSocket clients.
+    void publish(const Sample& sample) {
+      if (_history == nullptr || _websocket.connectedClients() == 0) {
+        return;
+      }
+
+      StreamString message;
+      SampleHistory::printSampleTo(message, sample);
+      _websocket.broadcastTXT(message);
+    }
+};
+
+#endif // __LOCAL_SERVER_H__
@@ -3,29 +3,75 @@
 
 /*
  * LocalStorage.h - Stores WiFi and Firebase configuration on the Esp8266's onboard SD/Flash.
- * 
- * Configuration is loaded from SPIFFS during init() from the file '/config.txt'.  '/config.txt'
- * is a binary file containing 4 null terimnated strings.
- * 
- * Note: You can reset previously saved configuration by pressing the RESET button during
- *       boot while the built-in LED is rapidly flashing (i.e., press RESET, wait for rapid
- *       flashing, press RESET again.)  This functionality is implemented in 'init()'.
+ *
+ * Configuration is loaded from SPIFFS during init().  It is stored as a fixed layout 'Settings'
+ * record, which is read in a single call into a struct (no per-field 'String' allocations.)
+ *
+ * Each record is stored with a header (magic, layout version, size and sequence number) and
+ * is followed by a CRC32 of the header and data.  Records are double-buffered in two files
+ * ('<name>.a' and '<name>.b'):  each save overwrites the file holding the older record with
+ * the next sequence number, and loading picks the valid record with the highest sequence
+ * number.  A power cut while saving can therefore only corrupt the record being written,
+ * in which case the previous record is loaded on the next boot.
+ *
+ * Other components may also store small records (e.g., the last cloud config) with
+ * 'saveRecord()'/'loadRecord()'.
+ *
+ * Configuration saved by earlier firmware in the legacy '/config.txt' format (4 null
+ * terminated strings) is migrated during 'init()'.
+ *
+ * Note: You can reset previously saved configuration by pressing the RESET button twice
+ *       within 3 seconds (i.e., press RESET, wait a moment for the device to boot, press
+ *       RESET again.)  This functionality is implemented in 'init()'.  (See DoubleReset.h.)
  */
 
 #include <assert.h>
+#include <string.h>
 #include "FS.h"
-#include "Device.h"
+#include "Crc32.h"
+#include "DoubleReset.h"
+#include "Log.h"
+#include "Trace.h"
 
 class LocalStorage {
+  public:
+    // WiFi and Firebase settings entered in the captive portal.  Increment '_settings_version'
+    // when changing the layout.
+    struct Settings {
+      char wifi_ssid[33];             // SSIDs are at most 32 characters
+      char wifi_password[65];         // WPA2 passphrases are at most 64 characters
+      char firebase_host[128];        // (Sizes match the portal parameters in 'Network'.)
+      char firebase_auth[128];
+    };
+
   private:
-    bool _isConfigLoaded = false;   // True if '/config.txt' was successfully loaded during 'init()'.
-  
-    String _wifi_ssid = "";         // During 'init()', these fields are populated from the contents
-    String _wifi_password = "";     // of '/config.txt', if it exists.
-    String _firebase_host = "";
-    String _firebase_auth = "";
-
-    const char* const _config_file_name = "/config.txt";
+    static const uint16_t _settings_version = 1;
+
+    // Identifies files written by 'saveRecord()'.
+    static const uint32_t _record_magic = 0x43525444;   // 'DTRC'
+
+    // Precedes the data of records written by 'saveRecord()'.
+    struct RecordHeader {
+      uint32_t magic;                 // '_record_magic'
+      uint16_t version;               // Caller-defined version of the data's layout
+      uint16_t size;                  // Size of the data in bytes
+      uint32_t sequence;              // Incremented by each save (the higher of the A/B copies is current)
+    };
+
+    // On-disk layout of a record.  ('crc' covers 'header' and 'data', excluding any padding.)
+    template <typename T> struct Record {
+      RecordHeader header;
+      T data;
+      uint32_t crc;
+    };
+
+    bool _isConfigLoaded = false;   // True if the settings were successfully loaded during 'init()'.
+    Settings _settings;             // During 'init()', populated from the saved record, if it exists.
+    DoubleReset _double_reset;      // Detects the user's request to clear the saved settings.
+
+    const char* const _config_file_name = "/config";
+    const char* const _legacy_config_file_name = "/config.txt";
+    // Obsolete sentinel file used by earlier firmware to detect a double reset.
     const char* const _reset_sentinel_file_name = "/reset-config.txt";
     const char* const _for_write = "w";
     const char* const _for_read = "r";
@@ -37,140 +83,279 @@ class LocalStorage {
 
       // 'SPIFFS.open()' automatically creates, opens, or replaces as appropriate.
       // Differentiate these cases in the log.
-      Serial.print(
+      LOG(STORAGE, DEBUG,
         mode == _for_write
           ? SPIFFS.exists(fileName)
-            ? "Replacing '"
-            : "Creating '"
-          : "Opening '");
-      
-      Serial.print(_config_file_name); Serial.print("' for '"); Serial.print(mode); Serial.print("': ");
+            ? F("Replacing '")
+            : F("Creating '")
+          : F("Opening '"),
+        fileName, F("' for '"), mode, F("': "));
 
       // Open the file and log success/failure.
       File file = SPIFFS.open(fileName, mode);
       if (!file) {
-        Serial.println("[FAILED]");
+        LOGLN(STORAGE, WARN, F("[FAILED]"));
         return file;
       }
 
-      Serial.println("[OK]");
+      LOGLN(STORAGE, DEBUG, F("[OK]"));
 
       // Note: 'file' will be NULL if 'SPIFFS.open()' failed.
       return file;
     }
 
-    // Opens '/config.txt'.
-    File openConfigFile(const char* const mode) {
-      return openFile(_config_file_name, mode);
+    // Returns the name of the A (slot = 0) or B (slot = 1) copy of the record 'name'.
+    static String slotFileName(const char* const name, int slot) {
+      return String(name) + (slot == 0 ? ".a" : ".b");
     }
 
-    // Loads the next null-terminated string from the given 'file'.  The 'name'
-    // parameter is only used for identifying which string we're reading in the log.
-    String loadString(File file, const char* const name) {
-      Serial.print("  "); Serial.print(name); Serial.print(": ");
-      String value = file.readStringUntil('\0');
-      Serial.print("'"); Serial.print(value); Serial.println("'");
-      return value;
+    // Returns the CRC of the record's header and data.
+    template <typename T> static uint32_t crcOf(const Record<T>& record) {
+      uint32_t crc = Crc32::update(Crc32::_initial, &record.header, sizeof(record.header));
+      return Crc32::update(crc, &record.data, sizeof(record.data));
+    }
+
+    // Reads the copy of record 'name' in 'slot' into 'record'.  Returns false if the file is
+    // missing, truncated, corrupt, or was saved with a different 'version' or size.
+    template <typename T> bool readSlot(const char* const name, int slot, uint16_t version, Record<T>& record) {
+      String fileName = slotFileName(name, slot);
+      if (!SPIFFS.exists(fileName)) {
+        return false;
+      }
+
+      File file = openFile(fileName.c_str(), _for_read);
+      if (!file) {
+        return false;
+      }
+
+      bool success = file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record);
+      file.close();
+
+      if (!success
+        || record.header.magic != _record_magic
+        || record.header.version != version
+        || record.header.size != sizeof(T)
+        || record.crc != crcOf(record)
+      ) {
+        LOGLN(STORAGE, WARN, F("  (Ignoring invalid record '"), fileName, F("'.)"));
+        return false;
+      }
+
+      return true;
+    }
+
+    // Reads both copies of record 'name'.  Returns the slot holding the current (valid, highest
+    // sequence) copy and loads it into 'record', or returns -1 if neither copy is valid.
+    template <typename T> int readCurrent(const char* const name, uint16_t version, Record<T>& record) {
+      Record<T> other;
+      bool validA = readSlot(name, 0, version, record);
+      bool validB = readSlot(name, 1, version, other);
+
+      // (Compare sequence numbers by difference, so that the ordering survives wraparound.)
+      if (validB && (!validA || static_cast<int32_t>(other.header.sequence - record.header.sequence) > 0)) {
+        record = other;
+        return 1;
+      }
+
+      return validA ? 0 : -1;
     }
 
-    // Saves the null-terminated string to the given 'file'.  The 'name' parameter
-    // is only used for identifying which string we're writing in the log.
-    void saveString(File file, const char* const name, const char* const value) {
-      Serial.print("  "); Serial.print(name); Serial.print(": '"); Serial.print(value); Serial.println("'");
-      file.print(value);
-      file.print('\0');   // The above 'file.print(value)' does not include the null-terminator.
+    // Copies the null-terminated 'value' into 'buffer' (of capacity 'size'), truncating if
+    // necessary and zero filling the remainder.
+    static void copyString(char* buffer, const char* const value, size_t size) {
+      strncpy(buffer, value, size - 1);
+      buffer[size - 1] = '\0';
     }
 
-    // Initializes this class's member variables with the values saved in '/config.txt'.
-    bool loadConfig() {
-      Serial.println("Loading local configuration: "); Serial.print("  ");
-      File configFile = openConfigFile("r");
+    // Loads the next null-terminated string from the given legacy '/config.txt' 'file'.  The
+    // 'name' parameter is only used for identifying which string we're reading in the log.
+    void loadLegacyString(File file, const __FlashStringHelper* name, char* buffer, size_t size) {
+      String value = file.readStringUntil('\0');
+      LOGLN(STORAGE, INFO, F("  "), name, F(": '"), value, F("'"));
+      copyString(buffer, value.c_str(), size);
+    }
+
+    // Migrates settings saved by earlier firmware in the legacy '/config.txt' format, if it
+    // exists.  The legacy file is removed once the settings are saved in the current format.
+    bool migrateLegacyConfig() {
+      if (!SPIFFS.exists(_legacy_config_file_name)) {
+        return false;
+      }
+
+      LOGLN(STORAGE, INFO, F("Migrating legacy local configuration: "));
+      LOG(STORAGE, DEBUG, F("  "));
+      File configFile = openFile(_legacy_config_file_name, _for_read);
       if (!configFile) {
-        Serial.println("(Local configuration has been cleared.)");
         return false;
       }
-      
-      _wifi_ssid = loadString(configFile, "WiFi SSID    ");
-      _wifi_password = loadString(configFile, "WiFi Password");
-      _firebase_host = loadString(configFile, "Firebase Host");
-      _firebase_auth = loadString(configFile, "Firebase Auth");
+
+      Settings settings;
+      memset(&settings, 0, sizeof(settings));
+      loadLegacyString(configFile, F("WiFi SSID    "), settings.wifi_ssid, sizeof(settings.wifi_ssid));
+      loadLegacyString(configFile, F("WiFi Password"), settings.wifi_password, sizeof(settings.wifi_password));
+      loadLegacyString(configFile, F("Firebase Host"), settings.firebase_host, sizeof(settings.firebase_host));
+      loadLegacyString(configFile, F("Firebase Auth"), settings.firebase_auth, sizeof(settings.firebase_auth));
       configFile.close();
+
+      // If the settings could not be saved, use them for now and keep the legacy file so that
+      // migration is retried on the next boot.
+      if (!saveSettings(settings)) {
+        _settings = settings;
+        return true;
+      }
+
+      SPIFFS.remove(_legacy_config_file_name);
+      return true;
     }
-  
+
+    // Initializes '_settings' with the values saved by 'saveConfig()'.
+    bool loadConfig() {
+      LOGLN(STORAGE, INFO, F("Loading local configuration: "));
+      if (loadRecord(_config_file_name, _settings_version, _settings)) {
+        LOGLN(STORAGE, INFO, F("  WiFi SSID    : '"), _settings.wifi_ssid, F("'"));
+        LOGLN(STORAGE, INFO, F("  WiFi Password: '"), _settings.wifi_password, F("'"));
+        LOGLN(STORAGE, INFO, F("  Firebase Host: '"), _settings.firebase_host, F("'"));
+        LOGLN(STORAGE, INFO, F("  Firebase Auth: '"), _settings.firebase_auth, F("'"));
+        return true;
+      }
+
+      if (migrateLegacyConfig()) {
+        return true;
+      }
+
+      LOGLN(STORAGE, INFO, F("  (Local configuration has been cleared.)"));
+      memset(&_settings, 0, sizeof(_settings));
+      return false;
+    }
+
+    // Saves 'settings' and, if successful, makes them the current settings.
+    bool saveSettings(const Settings& settings) {
+      LOG(STORAGE, DEBUG, F("  "));
+      if (!saveRecord(_config_file_name, _settings_version, settings)) {
+        LOGLN(STORAGE, ERROR, F("Saving local configuration: [FAILED]"));
+        return false;
+      }
+
+      _settings = settings;
+      _isConfigLoaded = true;
+      return true;
+    }
+
+    // Removes both copies of the record 'name'.
+    void removeRecord(const char* const name) {
+      SPIFFS.remove(slotFileName(name, 0));
+      SPIFFS.remove(slotFileName(name, 1));
+    }
+
   public:
+    // Saves 'data' as the record 'name', tagged with the caller's layout 'version'.  Returns
+    // false if the record could not be written, in which case the previously saved record
+    // (if any) is still current.
+    template <typename T> bool saveRecord(const char* const name, uint16_t version, const T& data) {
+      // Overwrite the slot that does not hold the current record.
+      Record<T> record;
+      int current = readCurrent(name, version, record);
+      uint32_t sequence = current < 0
+        ? 0
+        : record.header.sequence + 1;
+      int slot = current == 0 ? 1 : 0;
+
+      memset(static_cast<void*>(&record), 0, sizeof(record));
+      record.header = { _record_magic, version, sizeof(T), sequence };
+      record.data = data;
+      record.crc = crcOf(record);
+
+      String fileName = slotFileName(name, slot);
+      File file = openFile(fileName.c_str(), _for_write);
+      if (!file) {
+        return false;
+      }
+
+      bool success = file.write(reinterpret_cast<const uint8_t*>(&record), sizeof(record)) == sizeof(record);
+      file.close();
+
+      return success;
+    }
+
+    // Loads the current copy of the record 'name' saved by 'saveRecord()' into 'data'.  Returns
+    // false (leaving 'data' unmodified) if there is no valid copy saved with 'version'.
+    template <typename T> bool loadRecord(const char* const name, uint16_t version, T& data) {
+      Record<T> record;
+      if (readCurrent(name, version, record) < 0) {
+        return false;
+      }
+
+      data = record.data;
+      return true;
+    }
+
     // Called by 'Network::init()' when we have updated configuration to save from the
-    // captive portal.
-    void saveConfig(
+    // captive portal.  Returns false if the configuration could not be saved.
+    bool saveConfig(
       const char* const wifiSsid,
       const char* const wifiPassword,
       const char* const firebaseHost,
       const char* const firebaseAuth
     ) {
-      Serial.println("Saving local configuration: "); Serial.print("  ");
-      File configFile = openConfigFile("w");
-      if (!configFile) {
-        Serial.println("Saving local configuration: [FAILED]");
-        return;
-      }
+      LOGLN(STORAGE, INFO, F("Saving local configuration: "));
 
-      saveString(configFile, "WiFi SSID    ", wifiSsid);
-      saveString(configFile, "WiFi Password", wifiPassword);
-      saveString(configFile, "Firebase Host", firebaseHost);
-      saveString(configFile, "Firebase Auth", firebaseAuth);
-      configFile.close();
+      Settings settings;
+      memset(&settings, 0, sizeof(settings));
+      copyString(settings.wifi_ssid, wifiSsid, sizeof(settings.wifi_ssid));
+      copyString(settings.wifi_password, wifiPassword, sizeof(settings.wifi_password));
+      copyString(settings.firebase_host, firebaseHost, sizeof(settings.firebase_host));
+      copyString(settings.firebase_auth, firebaseAuth, sizeof(settings.firebase_auth));
 
-      // Remove the sentinel file that indicates that local configuration should be/has been
-      // cleared (if it exists.)
-      SPIFFS.remove(_reset_sentinel_file_name);
+      return saveSettings(settings);
     }
 
-    void init(Device& device) {
-      Serial.print("Mounting SPIFFS file system (be patient if formatting a new device): ");
-      if (!SPIFFS.begin()) {
-        Serial.println("[FAILED]");
+    void init() {
+      LOG(STORAGE, INFO, F("Mounting SPIFFS file system (be patient if formatting a new device): "));
+      TRACE_BEGIN(SpiffsMount);
+      bool mounted = SPIFFS.begin();
+      TRACE_END(SpiffsMount);
+      if (!mounted) {
+        LOGLN(STORAGE, ERROR, F("[FAILED]"));
       }
 
-      Serial.println("[OK]");
+      LOGLN(STORAGE, INFO, F("[OK]"));
+
+      // If the device was reset twice in quick succession, the user has requested that we delete
+      // our saved configuration.
+      if (_double_reset.detect()) {
+        // Remove the saved configuration (in both the current and legacy formats), if it exists.
+        removeRecord(_config_file_name);
+        SPIFFS.remove(_legacy_config_file_name);
+        LOGLN(STORAGE, INFO);
+        LOGLN(STORAGE, INFO, F("*** Note: Local configuration has been cleared."));
+      } else if (_double_reset.isArmed()) {
+        // Prompt the user (if a serial terminal is connected.)  The window is closed by 'poll()'
+        // without delaying boot.
+        LOGLN(STORAGE, INFO);
+        LOGLN(STORAGE, INFO, F("*** Press [Reset] again within 3 seconds to clear local configuration."));
+      }
+      LOGLN(STORAGE, INFO);
 
-      // If the sentinel file exists, the user has requested that we delete our saved configuration.
+      // Remove the sentinel file left by earlier firmware, if any.
       if (SPIFFS.exists(_reset_sentinel_file_name)) {
-        // Remove '/config.txt', if it exists.
-        SPIFFS.remove(_config_file_name);
-        Serial.println();
-        Serial.println("*** Note: Local configuration has been cleared.");
-      } else {
-        // Create a sentinel file that we use to detect if the device resets in the
-        // next three seconds.
-        File sentinelFile = openFile(_reset_sentinel_file_name, "w");
-
-        // Prompt the user to press RESET now if they want to clear the local configuration,
-        // both via a serial terminal (if connected) and by blinking the LED rapidly.
-        Serial.println();
-        Serial.print("*** Press [Reset] now to clear local configuration: ");
-        device.blinkLed(/* rateInMilliseconds = */ 100);
-
-        // Give the user a window of three seconds to respond.
-        delay(3000);
-
-        // User does not want to clear local config.  Remove the sentinel file.
         SPIFFS.remove(_reset_sentinel_file_name);
-
-        // Notify the user that the window for clearing local config has expired.
-        device.setLed(true);
-        Serial.println("[Timeout]");
       }
 
-      Serial.println();
-
-      // Load the local config from '/config.txt', if it exists.
+      // Load the saved local config, if it exists.
       _isConfigLoaded = loadConfig();
     }
 
+    // Closes the window for clearing the local configuration once it has elapsed.  (Call
+    // from the main loop.)
+    void poll() {
+      _double_reset.poll();
+    }
+
     bool isConfigLoaded() const                 { return _isConfigLoaded; }
-    const char* const getWifiSSID() const       { return _wifi_ssid.c_str(); }
-    const char* const getWifiPassword() const   { return _wifi_password.c_str(); }
-    const char* const getFirebaseHost() const   { return _firebase_host.c_str(); }
-    const char* const getFirebaseAuth() const   { return _firebase_auth.c_str(); }
+    const char* const getWifiSSID() const       { return _settings.wifi_ssid; }
+    const char* const getWifiPassword() const   { return _settings.wifi_password; }
+    const char* const getFirebaseHost() const   { return _settings.firebase_host; }
+    const char* const getFirebaseAuth() const   { return _settings.firebase_auth; }
 };
 
 #endif // __LOCAL_STORAGE_H__
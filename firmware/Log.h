@@ -0,0 +1,379 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+/*
+ * Log.h - Non-blocking diagnostic output to the serial monitor.
+ *
+ * At 74880 baud the UART transmits ~7.5 bytes per millisecond, and its hardware FIFO only
+ * holds 128 bytes, so printing directly to 'Serial' stalls the caller whenever more than a
+ * line or two is printed at once.  'Log' instead appends output to a fixed size RAM ring and
+ * 'drain()' (called from the main loop's 'wait()') feeds the UART only as much as its FIFO
+ * can accept without blocking.
+ *
+ * If the ring is full, output is discarded and counted rather than stalling the caller.  A
+ * note with the number of discarded bytes is printed once there is room again.
+ *
+ * During 'setup()' (before 'setAsync(true)'), nothing drains the ring, so output is written
+ * directly to 'Serial' (blocking as before.)
+ *
+ * Messages logged every polling period are logged by token with 'token()'.  (See
+ * LogTokens.h.)  By default these are formatted as text on the device.  If LOG_TOKENIZED is
+ * defined as 1, they are instead transmitted as a compact binary frame and decoded on the
+ * host with tools/logdecode.cpp:
+ *
+ *    0x1E <token> <argument>...
+ *
+ * Integer arguments are zigzag encoded varints, floating point arguments are 4 byte little
+ * endian floats, and strings are a varint length followed by the characters.  (e.g., a
+ * 'Reading' message is 19 bytes rather than ~55 characters of text.)
+ *
+ * Logging should go through the LOG()/LOGLN()/LOG_TOKEN() macros, which take the module and
+ * level of the message:
+ *
+ *    LOGLN(CLOUD, INFO, F("Caching cloud config revision "), revision);
+ *
+ * Each module's level is fixed at compile time ('LOG_LEVEL_<MODULE>', defaulting to
+ * 'LOG_LEVEL'), and messages above it are removed from the firmware entirely (including their
+ * arguments and string literals.)  e.g., a production build with:
+ *
+ *    -DLOG_LEVEL=LOG_LEVEL_INFO
+ *
+ * removes the per-sample and per-ADC-read messages.  Messages that are compiled in can
+ * additionally be silenced at runtime with 'setLevel()' (see the cloud config's 'logLevel'.)
+ *
+ * String literals should be wrapped with 'F()' so that they remain in flash.  (On the
+ * ESP8266, unwrapped literals are copied to RAM at boot.)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <type_traits>
+#include <pgmspace.h>
+#include <Print.h>
+#include "LogTokens.h"
+
+#ifndef LOG_TOKENIZED
+#define LOG_TOKENIZED 0
+#endif
+
+// Log levels.  (Preprocessor constants so that they can be passed with '-D'.)
+#define LOG_LEVEL_NONE    0
+#define LOG_LEVEL_ERROR   1
+#define LOG_LEVEL_WARN    2
+#define LOG_LEVEL_INFO    3
+#define LOG_LEVEL_DEBUG   4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Per-module levels.
+#ifndef LOG_LEVEL_MAIN
+#define LOG_LEVEL_MAIN LOG_LEVEL              // firmware.ino, Startup
+#endif
+#ifndef LOG_LEVEL_SENSOR
+#define LOG_LEVEL_SENSOR LOG_LEVEL            // ADC reads and thermistor readings
+#endif
+#ifndef LOG_LEVEL_DEVICE
+#define LOG_LEVEL_DEVICE LOG_LEVEL            // Device (relay, mux)
+#endif
+#ifndef LOG_LEVEL_CLOUD
+#define LOG_LEVEL_CLOUD LOG_LEVEL             // CloudStorage
+#endif
+#ifndef LOG_LEVEL_STORAGE
+#define LOG_LEVEL_STORAGE LOG_LEVEL           // LocalStorage
+#endif
+#ifndef LOG_LEVEL_NETWORK
+#define LOG_LEVEL_NETWORK LOG_LEVEL           // Network, LocalServer
+#endif
+#ifndef LOG_LEVEL_CLOCK
+#define LOG_LEVEL_CLOCK LOG_LEVEL             // NTPTime, MonotonicClock
+#endif
+#ifndef LOG_LEVEL_POWER
+#define LOG_LEVEL_POWER LOG_LEVEL             // DeepSleep, Radio
+#endif
+
+// True if messages of 'level' from 'module' are compiled in and enabled at runtime.  (The
+// first term is a constant, so disabled messages are removed by the compiler.)
+#define LOG_ENABLED(module, level) \
+  (LOG_LEVEL_##module >= LOG_LEVEL_##level && _log.isEnabled(LOG_LEVEL_##level))
+
+// Prints the arguments (without a newline.)
+#define LOG(module, level, ...) \
+  do { if (LOG_ENABLED(module, level)) { _log.printArgs(__VA_ARGS__); } } while (0)
+
+// Prints the arguments followed by a newline.
+#define LOGLN(module, level, ...) \
+  do { if (LOG_ENABLED(module, level)) { _log.printlnArgs(__VA_ARGS__); } } while (0)
+
+// Logs a message by token.  (See 'Log::token()'.)
+#define LOG_TOKEN(module, level, ...) \
+  do { if (LOG_ENABLED(module, level)) { _log.token(__VA_ARGS__); } } while (0)
+
+class Log : public Print {
+  private:
+    // Size of the ring.  (About a quarter of a second of output at 74880 baud.)
+    static const uint16_t _capacity = 2048;
+
+    char     _ring[_capacity];
+    uint16_t _head = 0;                       // Index of the next byte to transmit
+    uint16_t _count = 0;                      // Number of bytes waiting to be transmitted
+    bool     _async = false;                  // If false, writes block rather than discard
+
+    uint32_t _dropped = 0;                    // Bytes discarded since the last overflow note
+    uint32_t _dropped_total = 0;              // Bytes discarded since boot
+
+    uint8_t  _level = LOG_LEVEL_DEBUG;        // Runtime level (see 'setLevel()')
+
+    // Copies as much of 'data' as fits into the ring.  Returns the number of bytes copied.
+    size_t append(const uint8_t* data, size_t size) {
+      size_t space = _capacity - _count;
+      if (size > space) {
+        size = space;
+      }
+
+      for (size_t i = 0; i < size; i++) {
+        _ring[(_head + _count + i) % _capacity] = data[i];
+      }
+      _count += size;
+      return size;
+    }
+
+    // Transmits up to 'maxBytes' from the ring.  (Stops at the end of the ring's storage, so
+    // that each call to 'Serial.write()' is contiguous.)
+    void transmit(size_t maxBytes) {
+      size_t size = _count;
+      if (size > maxBytes) {
+        size = maxBytes;
+      }
+      if (size > static_cast<size_t>(_capacity - _head)) {
+        size = _capacity - _head;
+      }
+
+      Serial.write(reinterpret_cast<const uint8_t*>(_ring + _head), size);
+      _head = (_head + size) % _capacity;
+      _count -= size;
+    }
+
+#if LOG_TOKENIZED
+    // Maximum size of an encoded message.  (Longer strings are truncated.)
+    static const uint8_t _max_frame = 64;
+
+    // Appends 'value' to 'frame' as a varint.
+    static void encodeVarint(uint8_t* frame, uint8_t& size, uint64_t value) {
+      do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (size < _max_frame) {
+          frame[size++] = value != 0 ? (byte | 0x80) : byte;
+        }
+      } while (value != 0);
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value>::type encode(uint8_t* frame, uint8_t& size, T value) {
+      // Zigzag encode so that small negative values are also short.
+      int64_t signedValue = static_cast<int64_t>(value);
+      encodeVarint(frame, size, (static_cast<uint64_t>(signedValue) << 1) ^ static_cast<uint64_t>(signedValue >> 63));
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type encode(uint8_t* frame, uint8_t& size, T value) {
+      float single = static_cast<float>(value);
+      if (size + sizeof(single) <= _max_frame) {
+        memcpy(frame + size, &single, sizeof(single));
+        size += sizeof(single);
+      }
+    }
+
+    static void encode(uint8_t* frame, uint8_t& size, const char* value) {
+      // (Omitted, like the other arguments, once an earlier string has filled the frame.)
+      if (size >= _max_frame) {
+        return;
+      }
+
+      size_t length = strlen(value);
+      size_t space = _max_frame - size - 1;
+      if (length > space) {
+        length = space;
+      }
+
+      encodeVarint(frame, size, length);
+      memcpy(frame + size, value, length);
+      size += length;
+    }
+
+    static void encode(uint8_t* frame, uint8_t& size, const __FlashStringHelper* value) {
+      // (See above.)
+      if (size >= _max_frame) {
+        return;
+      }
+
+      PGM_P chars = reinterpret_cast<PGM_P>(value);
+      size_t length = strlen_P(chars);
+      size_t space = _max_frame - size - 1;
+      if (length > space) {
+        length = space;
+      }
+
+      encodeVarint(frame, size, length);
+      memcpy_P(frame + size, chars, length);
+      size += length;
+    }
+
+    static void encodeAll(uint8_t* frame, uint8_t& size) { }
+
+    template <typename T, typename... Rest>
+    static void encodeAll(uint8_t* frame, uint8_t& size, T value, Rest... rest) {
+      encode(frame, size, value);
+      encodeAll(frame, size, rest...);
+    }
+#else
+    // Returns the format string of 'token'.  (In flash.)
+    static PGM_P formatOf(LogToken token) {
+      #define LOG_TOKEN_FORMAT(name, format) static const char format_##name[] PROGMEM = format;
+      LOG_TOKENS(LOG_TOKEN_FORMAT)
+      #undef LOG_TOKEN_FORMAT
+
+      static PGM_P const formats[] = {
+        #define LOG_TOKEN_FORMAT(name, format) format_##name,
+        LOG_TOKENS(LOG_TOKEN_FORMAT)
+        #undef LOG_TOKEN_FORMAT
+      };
+      return formats[static_cast<uint8_t>(token)];
+    }
+
+    // Prints 'format' up to the next argument specifier (or the end), returning a pointer to
+    // the character following the specifier (or the end.)
+    PGM_P printLiteral(PGM_P format) {
+      for (char c = pgm_read_byte(format); c != '\0'; c = pgm_read_byte(format)) {
+        if (c == '%') {
+          char next = pgm_read_byte(format + 1);
+          if (next != '%') {
+            return next != '\0' ? format + 2 : format + 1;
+          }
+          format++;
+        }
+        write(pgm_read_byte(format++));
+      }
+      return format;
+    }
+
+    void printFormat(PGM_P format) {
+      printLiteral(format);
+    }
+
+    template <typename T, typename... Rest>
+    void printFormat(PGM_P format, T value, Rest... rest) {
+      format = printLiteral(format);
+      print(value);
+      printFormat(format, rest...);
+    }
+#endif
+
+  public:
+    // Logs the message 'token' with the given arguments (which must match the specifiers in
+    // the token's format string.)
+    template <typename... Args>
+    void token(LogToken token, Args... args) {
+#if LOG_TOKENIZED
+      uint8_t frame[_max_frame];
+      uint8_t size = 0;
+      frame[size++] = _log_token_sync;
+      frame[size++] = static_cast<uint8_t>(token);
+      encodeAll(frame, size, args...);
+      write(frame, size);
+#else
+      printFormat(formatOf(token), args...);
+      println();
+#endif
+    }
+
+    // Prints each of the arguments with 'print()'.  (See LOG().)
+    void printArgs() { }
+
+    template <typename T, typename... Rest>
+    void printArgs(const T& value, const Rest&... rest) {
+      print(value);
+      printArgs(rest...);
+    }
+
+    // Prints each of the arguments with 'print()', followed by a newline.  (See LOGLN().)
+    template <typename... Args>
+    void printlnArgs(const Args&... args) {
+      printArgs(args...);
+      println();
+    }
+
+    // Silences messages above 'level' at runtime.  (Messages above the compile-time level of
+    // their module are already removed.)
+    void setLevel(uint8_t level)      { _level = level; }
+    uint8_t getLevel() const          { return _level; }
+    bool isEnabled(uint8_t level) const
+                                      { return level <= _level; }
+
+    // Once 'async' is true, output that does not fit in the ring is discarded rather than
+    // waiting for the UART.  (Set at the end of 'setup()', once 'drain()' is being called.)
+    void setAsync(bool async) { _async = async; }
+
+    size_t write(uint8_t c) override {
+      return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* data, size_t size) override {
+      if (!_async) {
+        // Preserve the order of any buffered output, then write through.
+        while (_count > 0) {
+          transmit(_count);
+        }
+        return Serial.write(data, size);
+      }
+
+      // Prefer discarding whole writes (e.g., 'print("...")') to truncating them mid-word.
+      if (_dropped > 0 || size > static_cast<size_t>(_capacity - _count)) {
+        _dropped += size;
+        _dropped_total += size;
+        return size;
+      }
+
+      return append(data, size);
+    }
+
+    // Transmits as much of the ring as the UART's FIFO can accept without blocking.  (Call
+    // frequently from the main loop.)
+    void drain() {
+      while (_count > 0) {
+        size_t space = Serial.availableForWrite();
+        if (space == 0) {
+          return;
+        }
+        transmit(space);
+      }
+
+      // Once the ring is empty, note any output that was discarded.
+      if (_dropped > 0) {
+        uint32_t dropped = _dropped;
+        _dropped = 0;
+
+        char note[48];
+        size_t length = snprintf_P(note, sizeof(note), PSTR("\r\n[Log overflow: %lu bytes dropped]\r\n"), static_cast<unsigned long>(dropped));
+        append(reinterpret_cast<const uint8_t*>(note), length);
+      }
+    }
+
+    // Transmits the entire ring, blocking until done.  (e.g., before deep sleep.)
+    void drainAll() {
+      while (_count > 0) {
+        transmit(_count);
+      }
+      Serial.flush();
+    }
+
+    uint16_t pending() const          { return _count; }
+    uint32_t getDropped() const       { return _dropped_total; }
+};
+
+// Defined in firmware.ino.
+extern Log _log;
+
+#endif // __LOG_H__
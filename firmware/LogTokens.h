@@ -0,0 +1,47 @@
+#ifndef __LOG_TOKENS_H__
+#define __LOG_TOKENS_H__
+
+/*
+ * LogTokens.h - String table for the messages the firmware logs every polling period.
+ *
+ * Each entry pairs a token with its format string.  The firmware logs a message by token
+ * with 'Log::token()'.  When built with LOG_TOKENIZED=1 (see Log.h), only the token and the
+ * raw binary arguments are transmitted, and the format strings are not linked into the
+ * firmware.  The host decoder (tools/logdecode.cpp) includes this same table to rebuild the
+ * text, so the table is the single source of truth for both sides.
+ *
+ * Format strings support '%d'/'%u' (integers), '%f' (floating point, printed with 2 decimals
+ * like 'Print::print(double)'), '%s' (strings) and '%%'.
+ *
+ * Append new tokens at the end.  (Reordering or removing tokens requires rebuilding the
+ * decoder to read logs from older firmware.)
+ */
+
+#include <stdint.h>
+
+#define LOG_TOKENS(X)                                                                                   \
+  X(AdcRaw,           "adc%d: %u")                                                                      \
+  X(Reading,          "adc%d: adc = %f r = %f C = %f F = %f")                                           \
+  X(SamplesTaken,     "  Samples taken: %u, rejected: %u")                                              \
+  X(BelowMinimum,     "Temperature below minimum safe operating temperature %f celsius.")               \
+  X(DeltaActive,      "Delta %f > %f: Collector active.")                                               \
+  X(DeltaInactive,    "Delta %f < %f: Collector inactive.")                                             \
+  X(Relay,            "Relay: %s (transitions: %u, closed: %us)")                                       \
+  X(RelayFault,       "*** Relay pin disagrees with expected state '%s' (faults: %u)")                  \
+  X(ClockSync,        "Clock: drift %fppm, slewing %fms")                                               \
+  X(RadioHour,        "Radio on %us in the last hour (%u wakes in total.)")                             \
+  X(CloudLogged,      "  Logged 'log/%u' (time %u)")
+
+enum class LogToken : uint8_t {
+  #define LOG_TOKEN_ENUM(name, format) name,
+  LOG_TOKENS(LOG_TOKEN_ENUM)
+  #undef LOG_TOKEN_ENUM
+
+  Count
+};
+
+// Marks the start of a tokenized message in the serial output.  (ASCII 'record separator',
+// which never appears in the firmware's text output.)
+static const uint8_t _log_token_sync = 0x1E;
+
+#endif // __LOG_TOKENS_H__
@@ -0,0 +1,66 @@
+#ifndef __METRIC_NAMES_H__
+#define __METRIC_NAMES_H__
+
+/*
+ * MetricNames.h - Names and help text of the metrics served at '/metrics'.
+ *
+ * Each entry gives the id passed to METRIC() where the metric is declared, its kind
+ * ('Counter', 'Gauge' or 'Histogram'), its name and its help text.  The strings are kept
+ * in flash.  (See METRIC_STRINGS() in Metrics.h.)  The host test (tools/scrapetest.cpp)
+ * includes this same table, registering a metric of each kind, so that every name and help
+ * string the firmware serves is checked against the exposition format.
+ *
+ * Metrics are declared in firmware.ino, except for those of the cloud uploads which are
+ * declared by 'CloudStorage'.
+ */
+
+#include "Metrics.h"
+
+#define METRIC_NAMES(X)                                                                                 \
+  X(samples,           Counter,   "dtc_samples_total",                                                  \
+    "Samples taken (one per polling period or wake from deep sleep).")                                  \
+  X(compressed,        Counter,   "dtc_samples_compressed_total",                                       \
+    "Samples not logged because they were within 'compressionDeviation' of the logged trend.")          \
+  X(adc_reads,         Counter,   "dtc_adc_reads_total",                                                \
+    "Raw ADC reads taken while oversampling.")                                                          \
+  X(relay_transitions, Counter,   "dtc_relay_transitions_total",                                        \
+    "Times the relay has opened or closed.")                                                            \
+  X(relay_faults,      Counter,   "dtc_relay_faults_total",                                             \
+    "Times the relay pin disagreed with its expected state.")                                           \
+  X(relay_closed,      Gauge,     "dtc_relay_closed",                                                   \
+    "1 if the relay is closed (collector engaged), otherwise 0.")                                       \
+  X(log_dropped,       Counter,   "dtc_log_dropped_bytes_total",                                        \
+    "Diagnostic output discarded because the serial ring was full.")                                    \
+  X(heap,              Gauge,     "dtc_heap_free_bytes",                                                \
+    "Free heap.")                                                                                       \
+  X(rssi,              Gauge,     "dtc_wifi_rssi_dbm",                                                  \
+    "WiFi signal strength, or 0 if not connected.")                                                     \
+  X(uptime,            Gauge,     "dtc_uptime_seconds",                                                 \
+    "Time since boot.")                                                                                 \
+  X(polling_period,    Gauge,     "dtc_polling_period_seconds",                                         \
+    "Length of the current polling period.")                                                            \
+  X(actuation_latency, Histogram, "dtc_actuation_latency_seconds",                                      \
+    "Time from the end of the last sample window before the temperature delta crossed "                 \
+    "'deltaTOn'/'deltaTOff' until the relay changed.")                                                  \
+  X(event_queue,       Histogram, "dtc_event_queue_seconds",                                            \
+    "Time from queueing an event until it was logged.")                                                 \
+  X(sample_queue,      Histogram, "dtc_sample_queue_seconds",                                           \
+    "Time from taking a sample until it was logged (including batching).")                              \
+  X(events_dropped,    Counter,   "dtc_events_dropped_total",                                           \
+    "Events discarded because the event queue was full.")                                               \
+  X(logged,            Counter,   "dtc_cloud_logged_total",                                             \
+    "Samples written to Firebase.")                                                                     \
+  X(events_logged,     Counter,   "dtc_cloud_events_logged_total",                                      \
+    "Events written to Firebase.")                                                                      \
+  X(log_retries,       Counter,   "dtc_cloud_log_retries_total",                                        \
+    "Attempts to write a sample or event to Firebase that retried a failed attempt.")                   \
+  X(log_failures,      Counter,   "dtc_cloud_log_failures_total",                                       \
+    "Samples or events dropped after all attempts to write them to Firebase failed.")                   \
+  X(log_seconds,       Histogram, "dtc_cloud_log_seconds",                                              \
+    "Duration of each attempt to write a sample or event to Firebase.")
+
+#define METRIC_NAMES_STRINGS(id, kind, name, help) METRIC_STRINGS(id, name, help)
+METRIC_NAMES(METRIC_NAMES_STRINGS)
+#undef METRIC_NAMES_STRINGS
+
+#endif // __METRIC_NAMES_H__
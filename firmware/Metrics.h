@@ -0,0 +1,186 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+/*
+ * Metrics.h - Counters, gauges and histograms exposed in the Prometheus text format.
+ *
+ * Each metric registers itself with the global '_metrics' registry when constructed, so
+ * metrics are declared alongside the code they measure (as globals or members of global
+ * objects) and nothing is allocated on the heap.  The registry is served by 'LocalServer' at:
+ *
+ *    http://<device-ip>/metrics
+ *
+ * Counters and gauges either hold a value updated by the caller ('inc()', 'set()'), or read
+ * it on demand from a function (e.g., the free heap, or a count the owning class already
+ * keeps.)  Histograms have a fixed set of bucket bounds, given at construction.
+ *
+ * Lines end with '\n' alone.  (Prometheus rejects the '\r' that 'println()' would add.)
+ *
+ * Metric names follow the Prometheus conventions ('dtc_' prefix, base units, counters
+ * ending in '_total'.)  Names and help text are kept in flash.  (Add them to the table in
+ * MetricNames.h and pass METRIC() to the constructor.)
+ *
+ * The host test tools/scrapetest.cpp checks the exposition format, including every name
+ * and help string in MetricNames.h.
+ */
+
+#include <pgmspace.h>
+#include <Print.h>
+
+class Metric {
+  public:
+    enum Type : uint8_t { CounterType, GaugeType, HistogramType };
+
+  private:
+    const __FlashStringHelper* const _name;
+    const __FlashStringHelper* const _help;
+    const Type _type;
+    Metric* _next = nullptr;                  // Next metric in the registry
+
+    friend class Metrics;
+
+  protected:
+    Metric(const __FlashStringHelper* name, const __FlashStringHelper* help, Type type);
+
+    const __FlashStringHelper* name() const { return _name; }
+
+    // Prints the sample lines of the metric.
+    virtual void printSamplesTo(Print& out) const = 0;
+};
+
+// The registry of all metrics.  (Metrics are printed in the order they were constructed.)
+class Metrics {
+  private:
+    Metric* _first = nullptr;
+    Metric* _last = nullptr;
+
+  public:
+    void add(Metric* metric) {
+      if (_last == nullptr) {
+        _first = metric;
+      } else {
+        _last->_next = metric;
+      }
+      _last = metric;
+    }
+
+    // Prints all metrics in the Prometheus text exposition format (version 0.0.4).
+    void printTo(Print& out) const {
+      for (const Metric* metric = _first; metric != nullptr; metric = metric->_next) {
+        out.print(F("# HELP ")); out.print(metric->_name); out.print(' '); out.print(metric->_help); out.print('\n');
+        out.print(F("# TYPE ")); out.print(metric->_name); out.print(' ');
+        out.print(metric->_type == Metric::CounterType
+          ? F("counter")
+          : metric->_type == Metric::GaugeType
+            ? F("gauge")
+            : F("histogram"));
+        out.print('\n');
+        metric->printSamplesTo(out);
+      }
+    }
+};
+
+// Defined in firmware.ino.  ('Metrics' is constant initialized, so metrics may register
+// during the construction of other globals.)
+extern Metrics _metrics;
+
+inline Metric::Metric(const __FlashStringHelper* name, const __FlashStringHelper* help, Type type)
+  : _name(name), _help(help), _type(type) {
+  _metrics.add(this);
+}
+
+class Counter : public Metric {
+  private:
+    uint32_t _value = 0;
+    uint32_t (*_read)() = nullptr;            // If set, reads the value instead of '_value'
+
+  protected:
+    void printSamplesTo(Print& out) const override {
+      out.print(name()); out.print(' '); out.print(value()); out.print('\n');
+    }
+
+  public:
+    Counter(const __FlashStringHelper* name, const __FlashStringHelper* help, uint32_t (*read)() = nullptr)
+      : Metric(name, help, CounterType), _read(read) { }
+
+    void inc(uint32_t amount = 1)   { _value += amount; }
+    uint32_t value() const          { return _read != nullptr ? _read() : _value; }
+};
+
+class Gauge : public Metric {
+  private:
+    float _value = 0;
+    float (*_read)() = nullptr;               // If set, reads the value instead of '_value'
+
+  protected:
+    void printSamplesTo(Print& out) const override {
+      out.print(name()); out.print(' '); out.print(value(), /* digits = */ 3); out.print('\n');
+    }
+
+  public:
+    Gauge(const __FlashStringHelper* name, const __FlashStringHelper* help, float (*read)() = nullptr)
+      : Metric(name, help, GaugeType), _read(read) { }
+
+    void set(float value)           { _value = value; }
+    float value() const             { return _read != nullptr ? _read() : _value; }
+};
+
+// Histogram with 'N' buckets, bounded above by the given (ascending) 'bounds'.  (Plus the
+// implicit '+Inf' bucket.)
+template <uint8_t N> class Histogram : public Metric {
+  private:
+    const float* const _bounds;
+    uint32_t _buckets[N + 1] = { 0 };         // Non-cumulative counts.  ('_buckets[N]' is '+Inf')
+    uint32_t _count = 0;
+    float _sum = 0;
+
+  protected:
+    void printSamplesTo(Print& out) const override {
+      uint32_t cumulative = 0;
+      for (uint8_t i = 0; i <= N; i++) {
+        cumulative += _buckets[i];
+        out.print(name()); out.print(F("_bucket{le=\""));
+        if (i < N) {
+          out.print(_bounds[i], /* digits = */ 3);
+        } else {
+          out.print(F("+Inf"));
+        }
+        out.print(F("\"} ")); out.print(cumulative); out.print('\n');
+      }
+
+      out.print(name()); out.print(F("_sum ")); out.print(_sum, /* digits = */ 3); out.print('\n');
+      out.print(name()); out.print(F("_count ")); out.print(_count); out.print('\n');
+    }
+
+  public:
+    Histogram(const __FlashStringHelper* name, const __FlashStringHelper* help, const float (&bounds)[N])
+      : Metric(name, help, HistogramType), _bounds(bounds) { }
+
+    void observe(float value) {
+      uint8_t i = 0;
+      while (i < N && value > _bounds[i]) {
+        i++;
+      }
+      _buckets[i]++;
+      _count++;
+      _sum += value;
+    }
+
+    uint32_t count() const          { return _count; }
+};
+
+// Declares the name and help text of a metric in flash, e.g.:
+//
+//    METRIC_STRINGS(samples, "dtc_samples_total", "Samples taken.")
+//    Counter _samples_metric { METRIC(samples) };
+//
+// ('F()' cannot be used outside of a function.)
+#define METRIC_STRINGS(id, name, help)                                  \
+  static const char _metric_name_##id[] PROGMEM = name;                 \
+  static const char _metric_help_##id[] PROGMEM = help;
+
+#define METRIC(id)                                                      \
+  reinterpret_cast<const __FlashStringHelper*>(_metric_name_##id),      \
+  reinterpret_cast<const __FlashStringHelper*>(_metric_help_##id)
+
+#endif // __METRICS_H__
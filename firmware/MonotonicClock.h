@@ -0,0 +1,182 @@
+#ifndef __MONOTONIC_CLOCK_H__
+#define __MONOTONIC_CLOCK_H__
+
+/*
+ * MonotonicClock.h - Strictly increasing UTC timestamps for samples, disciplined by NTP.
+ *
+ * The 'Time' library's 'now()' is stepped whenever its sync provider receives a new NTP
+ * timestamp, so consecutive timestamps may go backwards or skip, and only has a resolution
+ * of one second.  This clock instead:
+ *
+ *    - Counts time with 'micros()', extended to 64 bits by tracking its overflow (every ~71
+ *      minutes.)  'poll()' must be called at least once per overflow period.
+ *    - Corrects the measured frequency error of the crystal ('getDriftPpm()'), estimated from
+ *      the NTP offsets over the longest available baseline.
+ *    - Slews (rather than steps) offsets reported by 'sync()' at no more than '_max_slew_ppm',
+ *      so the clock never runs backwards.  Only a forward error larger than
+ *      '_step_threshold_micros' steps the clock.  (The first sync sets the clock, unless
+ *      timestamps were already issued from the 'Time' library's estimate, in which case it
+ *      is corrected from the estimate in the same way.)
+ *
+ * tools/clockdrift.cpp simulates the clock with a drifting crystal and NTP jitter.
+ *
+ * NTP references are taken from the system time ('gettimeofday()'), which the ESP8266 core's
+ * SNTP client sets with sub-millisecond resolution.
+ */
+
+#include <sys/time.h>
+#include <TimeLib.h>
+#include "Log.h"
+
+class MonotonicClock {
+  private:
+    static const uint32_t _max_slew_ppm = 500;                      // Same limit as ntpd
+    static const uint64_t _step_threshold_micros = 1000000;         // Step forward if behind by more than 1s
+    static const uint64_t _min_drift_baseline_micros = 600000000;   // Measure drift over at least 10 minutes
+    static const uint32_t _sync_interval_millis = 60 * 1000;        // How often 'isSyncDue()' returns true
+
+    uint32_t _last_micros = 0;            // 'micros()' at the last call to 'micros64()'
+    uint32_t _micros_high = 0;            // Number of times 'micros()' has overflowed
+
+    bool     _synchronized = false;       // True after the first call to 'sync()'
+    uint64_t _last_mono = 0;              // 'micros64()' when '_utc_micros' was last advanced
+    uint64_t _utc_micros = 0;             // Current UTC time (in microseconds since the epoch)
+    double   _residual_micros = 0;        // Sub-microsecond remainder of drift/slew corrections
+    double   _pending_micros = 0;         // Offset remaining to be slewed (positive is ahead)
+    float    _drift_ppm = 0;              // Estimated crystal frequency error (positive runs slow)
+
+    uint64_t _first_mono = 0;             // 'micros64()' and reference UTC time at the first
+    uint64_t _first_reference = 0;        //   'sync()', used as the drift baseline
+    uint32_t _last_sync_millis = 0;       // 'millis()' at the last 'sync()'
+
+    uint64_t _last_timestamp_millis = 0;  // Last value returned by 'timestampMillis()'
+
+    // Advances '_utc_micros' to the present, applying the drift correction and slewing any
+    // pending offset.
+    void advance() {
+      uint64_t mono = micros64();
+      double elapsed = static_cast<double>(mono - _last_mono);
+      _last_mono = mono;
+
+      double maxSlew = elapsed * _max_slew_ppm * 1e-6;
+      double slew = _pending_micros > maxSlew
+        ? maxSlew
+        : _pending_micros < -maxSlew
+          ? -maxSlew
+          : _pending_micros;
+      _pending_micros -= slew;
+
+      _residual_micros += elapsed * (1 + _drift_ppm * 1e-6) + slew;
+      uint64_t whole = static_cast<uint64_t>(_residual_micros);
+      _residual_micros -= whole;
+      _utc_micros += whole;
+    }
+
+  public:
+    // Returns 'micros()' extended to 64 bits.
+    uint64_t micros64() {
+      uint32_t now = micros();
+      if (now < _last_micros) {
+        _micros_high++;
+      }
+      _last_micros = now;
+
+      return (static_cast<uint64_t>(_micros_high) << 32) | now;
+    }
+
+    // Tracks 'micros()' overflow.  (Call from the main loop.)
+    void poll() {
+      micros64();
+    }
+
+    // Returns true if the clock has not been synchronized within '_sync_interval_millis'.
+    bool isSyncDue() const {
+      return !_synchronized || millis() - _last_sync_millis >= _sync_interval_millis;
+    }
+
+    // Disciplines the clock with the current UTC time from the system clock (set by SNTP.)
+    // Returns false if the system clock has not yet been set.
+    bool sync() {
+      timeval tv;
+      gettimeofday(&tv, nullptr);
+      if (tv.tv_sec < 24 * 60 * 60) {
+        return false;
+      }
+
+      sync(static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec);
+      return true;
+    }
+
+    // Disciplines the clock with 'referenceMicros', the current UTC time in microseconds.
+    void sync(uint64_t referenceMicros) {
+      advance();
+      _last_sync_millis = millis();
+
+      if (!_synchronized) {
+        _synchronized = true;
+        _first_mono = _last_mono;
+        _first_reference = referenceMicros;
+
+        // If timestamps were already issued from the 'Time' library's estimate (e.g., set by
+        // 'DeepSleep' after a wake), continue from the estimate and correct it like any later
+        // sync.  (Stepping back would clamp the following timestamps to 1ms apart until the
+        // reference caught up with the last one.)
+        if (_last_timestamp_millis == 0) {
+          _utc_micros = referenceMicros;
+          return;
+        }
+
+        _utc_micros = max(static_cast<uint64_t>(now()) * 1000000, _last_timestamp_millis * 1000);
+        _residual_micros = 0;
+      }
+
+      // Positive if this clock is behind the reference.
+      double error = static_cast<double>(static_cast<int64_t>(referenceMicros - _utc_micros));
+      if (error > _step_threshold_micros) {
+        LOGLN(CLOCK, WARN, F("Clock stepped forward "), error / 1000, F("ms"));
+        _utc_micros = referenceMicros;
+        _pending_micros = 0;
+      } else {
+        _pending_micros = error;
+      }
+
+      // Estimate the frequency error from the elapsed reference time vs. elapsed 'micros()'
+      // since the first sync.  (The longer the baseline, the less the jitter of individual NTP
+      // responses matters.)
+      uint64_t baseline = _last_mono - _first_mono;
+      if (baseline >= _min_drift_baseline_micros) {
+        double referenceElapsed = static_cast<double>(referenceMicros - _first_reference);
+        _drift_ppm = (referenceElapsed - baseline) / baseline * 1e6;
+      }
+    }
+
+    // Returns the current UTC time in microseconds since the epoch.  (Not necessarily strictly
+    // increasing between calls, see 'timestampMillis()'.)
+    uint64_t nowMicros() {
+      if (!_synchronized) {
+        return static_cast<uint64_t>(now()) * 1000000;
+      }
+
+      advance();
+      return _utc_micros;
+    }
+
+    // Returns the current UTC time in milliseconds since the epoch.  Each call returns a value
+    // strictly greater than the last.
+    uint64_t timestampMillis() {
+      uint64_t timestamp = nowMicros() / 1000;
+      if (timestamp <= _last_timestamp_millis) {
+        timestamp = _last_timestamp_millis + 1;
+      }
+      _last_timestamp_millis = timestamp;
+      return timestamp;
+    }
+
+    bool isSynchronized() const   { return _synchronized; }
+    float getDriftPpm() const     { return _drift_ppm; }
+
+    // Offset (in microseconds) remaining to be slewed after the last 'sync()'.
+    float getPendingMicros() const { return _pending_micros; }
+};
+
+#endif // __MONOTONIC_CLOCK_H__
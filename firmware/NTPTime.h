@@ -9,6 +9,7 @@
 
 #include <Time.h>
 #include <TimeLib.h>
+#include "Log.h"
 
 extern "C" {
   #include <sntp.h>
@@ -41,10 +42,14 @@ class NTPTime {
       return result;
     }
     
+    bool _synchronized = false;               // True once the first NTP response has been received
+
   public:
-    void init(const char* const ntpServer, int8_t gmtOffset) {
+    // Begins synchronizing the 'Time' library with 'ntpServer' in the background and returns
+    // immediately.  (Call 'poll()' to detect when the first response arrives.)
+    void begin(const char* const ntpServer, int8_t gmtOffset) {
       // Set the NTP server.
-      Serial.print("Syncronizing clock with NTP server '"); Serial.print(ntpServer); Serial.println("': ");
+      LOGLN(CLOCK, INFO, F("Syncronizing clock with NTP server '"), ntpServer, F("': "));
       sntp_setservername(0, const_cast<char*>(ntpServer));
 
       // Set the timezone of the local device to use when printing to the log with 'timeAndDate()'.
@@ -59,7 +64,7 @@ class NTPTime {
         // The returned 'timestamp' may be zero if we have not yet recieved any responses from
         // the NTP server.
         if (timestamp > 0) {
-          Serial.print("  Clock synchronized to: "); Serial.print(sntp_get_real_time(timestamp));
+          LOG(CLOCK, DEBUG, F("  Clock synchronized to: "), sntp_get_real_time(timestamp));
         }
 
         // Return 'timestamp' to the 'Time' library as the new current time.
@@ -70,15 +75,21 @@ class NTPTime {
       // timestamp.
       sntp_init();
       setSyncInterval(1);
+    }
 
-      // Block until we've recieved our first response from the NTP server.
-      do {
-        delay(100);
-      } while((timeStatus() == timeNotSet));
+    // Returns true once we've recieved our first response from the NTP server.
+    bool poll() {
+      if (!_synchronized && timeStatus() != timeNotSet) {
+        _synchronized = true;
 
-      // Once we have the set the time/date, relax the sync interval to once every 30 minutes.
-      setSyncInterval(30 * 60);
+        // Once we have the set the time/date, relax the sync interval to once every 30 minutes.
+        setSyncInterval(30 * 60);
+      }
+
+      return _synchronized;
     }
+
+    bool isSynchronized() const { return _synchronized; }
 };
 
-#endif __NTPTIME_H__
+#endif // __NTPTIME_H__
@@ -11,6 +11,10 @@
  * 
  * The captive portal is used to configure both WiFi and Firebase, since the device needs
  * both to connect to the cloud and retrieve its remaining configuration.
+ *
+ * Neither connecting nor the captive portal block: both are serviced by 'poll()', so that the
+ * caller can continue controlling the collector while WiFi comes up (or while waiting for the
+ * user to configure the device.)
  * 
  * Note: You can force the captive portal to reconfigure by pressing the RESET button
  *       during boot to delete the locally stored settings.  (See note in LocalStorage.h.)
@@ -21,95 +25,155 @@
 #include <user_interface.h>
 #include "LocalStorage.h"
 #include "CloudStorage.h"
+#include "Log.h"
 
-// Used within init() to detect if 'WiFiManager::setSaveConfigCallback()' lambda was invoked.
+// Used by the captive portal to detect if 'WiFiManager::setSaveConfigCallback()' lambda was invoked.
 static bool _shouldSave;
 
 class Network {
-  public:
-    void init(Device& device, LocalStorage& localStorage) {
-      // Blink the built-in LED at a medium pace to indicate that a connection is in progress.
-      device.blinkLed(/* rateInMilliseconds = */ 500);
-      
-      WiFiManager wifiManager;
-
-      // WiFiManager uses the 'setSaveConfigCallback' to indicate that the configuration has
-      // changed.  Note when this occurs by setting '_shouldSave'.
-      _shouldSave = false;
-      wifiManager.setSaveConfigCallback([](){ _shouldSave = true; });
-
-      // Add custom parameters to the WiFiManager for configuring the Firebase host and secret.
-      char firebase_host_buffer[128] = "";
-      WiFiManagerParameter firebase_host_param("firebase_host", "Firebase Host", firebase_host_buffer, sizeof(firebase_host_buffer));
-      wifiManager.addParameter(&firebase_host_param);
-      
-      char firebase_auth_buffer[128] = "";
-      WiFiManagerParameter firebase_auth_param("firebase_auth", "Firebase Secret", firebase_auth_buffer, sizeof(firebase_auth_buffer));
-      wifiManager.addParameter(&firebase_auth_param);
-
+  private:
+    // If we have not connected using the saved WiFi settings within this time, fall back
+    // on the captive portal.
+    static const uint32_t _connect_timeout_millis = 60 * 1000;
+
+    // Time the captive portal remains open without the user saving new settings.  (The saved
+    // settings are then retried, and the portal reopened after '_connect_timeout_millis'.)
+    static const uint32_t _portal_timeout_seconds = 180;
+
+    uint32_t _connect_started_millis = 0;     // 'millis()' when the current connection attempt began
+    bool _connected = false;                  // True once 'WiFi.status()' has reported WL_CONNECTED
+    bool _portal_open = false;                // True while the captive portal is running
+
+    // The captive portal.  (Non-blocking, serviced by 'poll()'.)
+    WiFiManager _wifi_manager;
+    WiFiManagerParameter _firebase_host_param { "firebase_host", "Firebase Host", "", 128 };
+    WiFiManagerParameter _firebase_auth_param { "firebase_auth", "Firebase Secret", "", 128 };
+
+    // Opens the WiFiManager captive portal with SSID 'Solar-XXXXXX' and returns immediately.
+    // While the portal is open, 'poll()' services it and saves any new configuration the
+    // user enters.  (The collector continues to be controlled in the meantime.)
+    void openConfigPortal() {
       // Construct a stable SSID for the captive portal using the Esp8266's unique chip ID.
       String configPortalSSID = "Solar-";
       configPortalSSID.concat(String(system_get_chip_id(), HEX));
-      
-      // If we have saved setting in 'localStorage' attempt to connect using them.
-      if (localStorage.isConfigLoaded()) {
-        // Note: We always store/retrieve SSID/Password from 'localSettings', even though
-        //       the WiFiManager will use the last successful values stored in EEPROM.  We
-        //       do this because 'localSettings' survives firmware updates while the EEPROM
-        //       does not.
-        const char* const wifiSsid = localStorage.getWifiSSID();
-        const char* const wifiPassword = localStorage.getWifiPassword();
-        
-        Serial.println("Starting WiFi: ");
-        Serial.print("  SSID:     '"); Serial.print(wifiSsid); Serial.println("'");
-        Serial.print("  Password: '"); Serial.print(wifiPassword); Serial.println("'");
-  
-        // We call 'WiFi.begin()' ourselves instead of letting 'WiFiManager::autoConnect()'
-        // do it so we can specify the SSID/Password.
-        WiFi.begin(wifiSsid, wifiPassword);
-
-        // Have 'WiFiManager' wait for a successful connection.  If the connection fails,
-        // 'WiFiManager' will automatically start the captive portal using the SSID specified
-        // below.
-        wifiManager.autoConnect(configPortalSSID.c_str());
-      } else {
-        // There were no settings saved in local storage, go directly to the captive portal.
-        Serial.println("Starting configuration portal:");
-        wifiManager.startConfigPortal(configPortalSSID.c_str());
-      }
+
+      LOGLN(NETWORK, INFO, F("Starting configuration portal: "), configPortalSSID);
+      _shouldSave = false;
+      _wifi_manager.startConfigPortal(configPortalSSID.c_str());
+      _portal_open = true;
+    }
+
+    // Services the open captive portal.  Saves the new configuration to 'localStorage' if the
+    // user entered one, and notes when the portal has closed (i.e., connected or timed out.)
+    void pollConfigPortal(LocalStorage& localStorage) {
+      _wifi_manager.process();
 
       // If 'WiFiManager::setSaveConfigCallback()' invoked our callback, save the new configuration.
       if (_shouldSave) {
-        Serial.println("Retrieving configuration and saving.");
+        LOGLN(NETWORK, INFO, F("Retrieving configuration and saving."));
 
         // Retrieve the WiFi SSID/Password using the Expressif SDK.
         station_config conf;
         wifi_station_get_config(&conf);
 
-        // Retrieve the Firebase host/secret from our custom WiFiManager parameters.
-        strcpy(firebase_host_buffer, firebase_host_param.getValue());
-        strcpy(firebase_auth_buffer, firebase_auth_param.getValue());
-
-        // Save the new config to 'LocalStorage'.
+        // Save the new config (including the Firebase host/secret from our custom WiFiManager
+        // parameters) to 'LocalStorage'.
         localStorage.saveConfig(
           reinterpret_cast<const char*>(conf.ssid),
           reinterpret_cast<const char*>(conf.password),
-          firebase_host_buffer,
-          firebase_auth_buffer);
+          _firebase_host_param.getValue(),
+          _firebase_auth_param.getValue());
 
         _shouldSave = false;
       }
 
-      // Paranoid busy loop to await the WiFi connection.  
-      Serial.println(); Serial.println(); Serial.print("Connecting to WiFi: ");
-      while (WiFi.status() != WL_CONNECTED) {
-        delay(500);
+      // Close the portal once connected.  (e.g., the access point came back.)
+      if (WiFi.status() == WL_CONNECTED && _wifi_manager.getConfigPortalActive()) {
+        _wifi_manager.stopConfigPortal();
+      }
+
+      if (!_wifi_manager.getConfigPortalActive()) {
+        LOGLN(NETWORK, INFO, F("Configuration portal closed."));
+        _portal_open = false;
+        _connect_started_millis = millis();
+      }
+    }
+
+  public:
+    // Begins connecting to WiFi in the background using the settings saved in 'localStorage'
+    // and returns immediately.  (Call 'poll()' to monitor the connection.)
+    //
+    // If there are no saved settings, the device has never been configured, so the captive
+    // portal is opened immediately.  (See 'openConfigPortal()'.)
+    void begin(Device& device, LocalStorage& localStorage) {
+      // Blink the built-in LED at a medium pace to indicate that a connection is in progress.
+      device.blinkLed(/* rateInMilliseconds = */ 500);
+
+      // WiFiManager uses the 'setSaveConfigCallback' to indicate that the configuration has
+      // changed.  Note when this occurs by setting '_shouldSave'.
+      _wifi_manager.setConfigPortalBlocking(false);
+      _wifi_manager.setConfigPortalTimeout(_portal_timeout_seconds);
+      _wifi_manager.setSaveConfigCallback([](){ _shouldSave = true; });
+
+      // Add custom parameters to the WiFiManager for configuring the Firebase host and secret.
+      _wifi_manager.addParameter(&_firebase_host_param);
+      _wifi_manager.addParameter(&_firebase_auth_param);
+
+      if (!localStorage.isConfigLoaded()) {
+        // There were no settings saved in local storage, go directly to the captive portal.
+        openConfigPortal();
+        return;
+      }
+
+      // Note: We always store/retrieve SSID/Password from 'localSettings', even though
+      //       the WiFiManager will use the last successful values stored in EEPROM.  We
+      //       do this because 'localSettings' survives firmware updates while the EEPROM
+      //       does not.
+      const char* const wifiSsid = localStorage.getWifiSSID();
+      const char* const wifiPassword = localStorage.getWifiPassword();
+
+      LOGLN(NETWORK, INFO, F("Starting WiFi: "));
+      LOGLN(NETWORK, INFO, F("  SSID:     '"), wifiSsid, F("'"));
+      LOGLN(NETWORK, INFO, F("  Password: '"), wifiPassword, F("'"));
+
+      WiFi.mode(WIFI_STA);
+      WiFi.begin(wifiSsid, wifiPassword);
+      _connect_started_millis = millis();
+    }
+
+    // Returns true once connected to WiFi.  If the connection has not been established
+    // within '_connect_timeout_millis', opens the captive portal (without blocking), while
+    // continuing to retry the saved settings.
+    bool poll(Device& device, LocalStorage& localStorage) {
+      if (_portal_open) {
+        pollConfigPortal(localStorage);
       }
-      Serial.println(WiFi.localIP());
 
-      // Stop blinking the built-in LED.
-      device.setLed(true);
+      bool connected = WiFi.status() == WL_CONNECTED;
+
+      if (connected != _connected) {
+        _connected = connected;
+
+        if (connected) {
+          LOGLN(NETWORK, INFO, F("Connected to WiFi: "), WiFi.localIP());
+
+          // Stop blinking the built-in LED.
+          device.setLed(true);
+        } else {
+          LOGLN(NETWORK, WARN, F("Disconnected from WiFi."));
+          _connect_started_millis = millis();
+        }
+      }
+
+      if (!connected && !_portal_open && millis() - _connect_started_millis > _connect_timeout_millis) {
+        LOGLN(NETWORK, WARN, F("Timed out connecting to WiFi."));
+        openConfigPortal();
+      }
+
+      return _connected;
     }
+
+    bool isConnected() const { return _connected; }
 };
 
 #endif // __NETWORK_H__
@@ -0,0 +1,90 @@
+#ifndef __RADIO_H__
+#define __RADIO_H__
+
+/*
+ * Radio.h - Powers the WiFi radio down between upload windows and measures radio-on time.
+ *
+ * Each sample only takes a fraction of a second to upload, but the radio otherwise stays on
+ * (associated with the access point) for the whole polling period.  When the cloud logger
+ * batches uploads, it calls 'sleep()' after flushing a batch, which turns the modem off
+ * entirely ('WiFi.forceSleepBegin()'), and 'wake()' shortly before the next batch is due,
+ * which turns it back on and reconnects to the saved access point.
+ *
+ * 'poll()' reports the radio-on time over each hour.
+ */
+
+#include <ESP8266WiFi.h>
+#include "Log.h"
+
+class Radio {
+  private:
+    static const uint32_t _hour_millis = 60UL * 60 * 1000;
+
+    bool _asleep = false;                     // True between 'sleep()' and 'wake()'
+    uint32_t _wakes = 0;                      // Number of times the radio was woken by 'wake()'
+
+    uint32_t _hour_started_millis = 0;        // 'millis()' at the start of the current hour
+    uint32_t _accounted_millis = 0;           // 'millis()' up to which '_hour_on_millis' is accounted
+    uint32_t _hour_on_millis = 0;             // Radio-on time in the current hour
+    uint32_t _last_hour_on_millis = 0;        // Radio-on time in the last full hour
+
+    // Adds the radio-on time since the last call to the current hour.
+    void account() {
+      uint32_t now = millis();
+      if (!_asleep) {
+        _hour_on_millis += now - _accounted_millis;
+      }
+      _accounted_millis = now;
+    }
+
+  public:
+    // Turns the radio off.  (Disconnects from WiFi.)
+    void sleep() {
+      if (_asleep) {
+        return;
+      }
+
+      account();
+      _asleep = true;
+
+      WiFi.forceSleepBegin();
+      delay(1);                               // (The modem is only powered down after yielding.)
+    }
+
+    // Turns the radio on and begins reconnecting to the saved access point in the background.
+    // (See 'isConnected()'.)
+    void wake() {
+      if (!_asleep) {
+        return;
+      }
+
+      account();
+      _asleep = false;
+      _wakes++;
+
+      WiFi.forceSleepWake();
+      WiFi.mode(WIFI_STA);
+      WiFi.begin();                           // (Reconnects using the settings saved by 'Network'.)
+    }
+
+    // Reports the radio-on time at the end of each hour.  (Call from the main loop.)
+    void poll() {
+      if (millis() - _hour_started_millis < _hour_millis) {
+        return;
+      }
+
+      account();
+      _last_hour_on_millis = _hour_on_millis;
+      _hour_on_millis = 0;
+      _hour_started_millis = _accounted_millis;
+
+      LOG_TOKEN(POWER, INFO, LogToken::RadioHour, _last_hour_on_millis / 1000, _wakes);
+    }
+
+    bool isAsleep() const                     { return _asleep; }
+    bool isConnected() const                  { return !_asleep && WiFi.status() == WL_CONNECTED; }
+    uint32_t getWakes() const                 { return _wakes; }
+    uint32_t getLastHourOnMillis() const      { return _last_hour_on_millis; }
+};
+
+#endif // __RADIO_H__
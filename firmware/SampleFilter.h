@@ -0,0 +1,238 @@
+#ifndef __SAMPLE_FILTER_H__
+#define __SAMPLE_FILTER_H__
+
+/*
+ * SampleFilter.h - Combines the raw ADC samples taken during a polling period into a single
+ *                  value, optionally rejecting outliers (e.g., glitches induced by relay EMI.)
+ *
+ * Supported modes:
+ *
+ *    mean     - Arithmetic mean of all samples.  (The original behavior.)
+ *    median   - Median of all samples.
+ *    trimmed  - Mean of the samples remaining after discarding the lowest and highest
+ *               'trimPercent' percent of samples.
+ *    hampel   - Mean of the samples within 'hampelThreshold' scaled median absolute
+ *               deviations of the median.  (See https://en.wikipedia.org/wiki/Median_absolute_deviation)
+ *
+ * Samples are sorted with a Batcher odd-even merge sorting network sized to the next power
+ * of two.  The sequence of compare/exchanges does not depend on the data, so the cost is
+ * small and predictable (at most 191 compare/exchanges for 32 samples.)
+ * (See https://en.wikipedia.org/wiki/Batcher_odd%E2%80%93even_mergesort)
+ */
+
+#include <assert.h>
+#include <string.h>
+
+class SampleFilter {
+  public:
+    enum Mode : uint8_t { Mean, Median, TrimmedMean, Hampel };
+
+    // The maximum number of samples that may be added per polling period.
+    static const uint8_t _max_samples = 32;
+
+  private:
+    // Pads unused slots so that they sort after all valid ADC samples [0..1023].
+    static const uint16_t _padding = 0xFFFF;
+
+    // Scale factor that makes the median absolute deviation a consistent estimator of the
+    // standard deviation for normally distributed noise.
+    static constexpr float _mad_scale = 1.4826;
+
+    Mode     _mode = Mean;
+    uint8_t  _trim_percent = 25;              // Percent of samples trimmed from each end ('trimmed' only)
+    float    _hampel_threshold = 3;           // Rejection threshold in scaled MADs ('hampel' only)
+
+    uint16_t _samples[_max_samples];
+    uint8_t  _count = 0;
+    uint8_t  _rejected = 0;                   // Number of samples rejected by the last call to 'result()'
+
+    // Sorts 'a' and 'b' into ascending order without branching on the data.
+    static void compareExchange(uint16_t& a, uint16_t& b) {
+      uint16_t lo = a < b ? a : b;
+      uint16_t hi = a < b ? b : a;
+      a = lo;
+      b = hi;
+    }
+
+    // Returns the smallest power of two >= 'count'.
+    static uint8_t networkSize(uint8_t count) {
+      uint8_t n = 1;
+      while (n < count) {
+        n <<= 1;
+      }
+      return n;
+    }
+
+    // Sorts the first 'count' entries of 'values' in place using Batcher's odd-even merge
+    // sort.  Entries in [count..networkSize(count)) are overwritten with '_padding'.
+    static void sort(uint16_t* values, uint8_t count) {
+      uint8_t n = networkSize(count);
+      for (uint8_t i = count; i < n; i++) {
+        values[i] = _padding;
+      }
+
+      for (uint8_t p = 1; p < n; p <<= 1) {
+        for (uint8_t k = p; k >= 1; k >>= 1) {
+          for (uint8_t j = k % p; j + k < n; j += 2 * k) {
+            for (uint8_t i = 0; i < k && i + j + k < n; i++) {
+              if ((i + j) / (2 * p) == (i + j + k) / (2 * p)) {
+                compareExchange(values[i + j], values[i + j + k]);
+              }
+            }
+          }
+        }
+      }
+    }
+
+    // Returns twice the median of the first 'count' entries of the sorted 'values'.  (Doubled
+    // so that the median of an even number of integer samples remains an integer.)
+    static uint16_t twiceMedian(const uint16_t* sorted, uint8_t count) {
+      assert(count > 0);
+      uint8_t mid = count / 2;
+      return count % 2 != 0
+        ? 2 * sorted[mid]
+        : sorted[mid - 1] + sorted[mid];
+    }
+
+    // Mean of the sorted samples in [first..last).
+    static double meanOf(const uint16_t* sorted, uint8_t first, uint8_t last) {
+      assert(first < last);
+      uint32_t sum = 0;
+      for (uint8_t i = first; i < last; i++) {
+        sum += sorted[i];
+      }
+      return static_cast<double>(sum) / (last - first);
+    }
+
+    // Mean of the samples whose distance from the median is within '_hampel_threshold'
+    // scaled MADs.  Updates '_rejected' with the number of samples excluded.
+    double hampel(const uint16_t* sorted) {
+      uint16_t median2 = twiceMedian(sorted, _count);
+
+      // Absolute deviations (doubled, like 'median2') of each sample from the median.
+      uint16_t deviations[_max_samples];
+      for (uint8_t i = 0; i < _count; i++) {
+        uint16_t sample2 = 2 * sorted[i];
+        deviations[i] = sample2 > median2
+          ? sample2 - median2
+          : median2 - sample2;
+      }
+      sort(deviations, _count);
+
+      // The ADC is quantized, so quiet signals frequently have a MAD of zero.  Treat the
+      // MAD as at least 1 LSB (2 when doubled) so that +/-1 LSB of noise is not rejected.
+      uint16_t mad2 = twiceMedian(deviations, _count) / 2;
+      if (mad2 < 2) {
+        mad2 = 2;
+      }
+      float limit2 = _hampel_threshold * _mad_scale * mad2;
+
+      uint32_t sum = 0;
+      uint8_t accepted = 0;
+      for (uint8_t i = 0; i < _count; i++) {
+        uint16_t sample2 = 2 * sorted[i];
+        uint16_t deviation2 = sample2 > median2
+          ? sample2 - median2
+          : median2 - sample2;
+
+        if (deviation2 <= limit2) {
+          sum += sorted[i];
+          accepted++;
+        }
+      }
+
+      // The median itself is always within the limit, so at least one sample is accepted.
+      assert(accepted > 0);
+      _rejected = _count - accepted;
+      return static_cast<double>(sum) / accepted;
+    }
+
+  public:
+    // Parses the mode names used in the cloud config ('mean', 'median', 'trimmed', 'hampel').
+    // Unrecognized names fall back to 'Mean'.
+    static Mode parseMode(const char* const name) {
+      if (strcmp(name, "median") == 0)  { return Median; }
+      if (strcmp(name, "trimmed") == 0) { return TrimmedMean; }
+      if (strcmp(name, "hampel") == 0)  { return Hampel; }
+      return Mean;
+    }
+
+    void init(Mode mode, uint8_t trimPercent, float hampelThreshold) {
+      assert(trimPercent < 50);
+
+      _mode = mode;
+      _trim_percent = trimPercent;
+      _hampel_threshold = hampelThreshold;
+    }
+
+    // Discards the samples from the previous polling period.
+    void reset() {
+      _count = 0;
+    }
+
+    // Adds a raw ADC sample [0..1023] to the current polling period.
+    void add(uint16_t sample) {
+      assert(_count < _max_samples);
+      _samples[_count++] = sample;
+    }
+
+    uint8_t count() const     { return _count; }
+
+    // Unbiased variance (in ADC units squared) of all samples added since the last 'reset()',
+    // including any later rejected as outliers.  (0 if fewer than two samples.)
+    double variance() const {
+      if (_count < 2) {
+        return 0;
+      }
+
+      uint32_t sum = 0;
+      uint32_t sumOfSquares = 0;
+      for (uint8_t i = 0; i < _count; i++) {
+        sum += _samples[i];
+        sumOfSquares += static_cast<uint32_t>(_samples[i]) * _samples[i];
+      }
+
+      // The sums are exact integers (32 * 1023^2 fits in 32 bits) and their products are exact
+      // in a double's 53 bit mantissa, so this formula does not suffer cancellation error.
+      return (static_cast<double>(sumOfSquares) * _count - static_cast<double>(sum) * sum)
+        / (static_cast<double>(_count) * (_count - 1));
+    }
+
+    // Number of samples excluded from the last 'result()' as outliers or trimmed extremes.
+    uint8_t rejected() const  { return _rejected; }
+
+    // Returns the filtered ADC value of the samples added since the last 'reset()'.
+    double result() {
+      assert(_count > 0);
+      _rejected = 0;
+
+      if (_mode == Mean) {
+        return meanOf(_samples, 0, _count);
+      }
+
+      // The remaining modes require the samples in sorted order.  (Sorting in place is safe,
+      // as the order of samples within a period is not otherwise used.)
+      const uint16_t* sorted = _samples;
+      sort(_samples, _count);
+
+      switch (_mode) {
+        case Median:
+          return twiceMedian(sorted, _count) / 2.0;
+
+        case TrimmedMean: {
+          uint8_t trim = static_cast<uint16_t>(_count) * _trim_percent / 100;
+          _rejected = 2 * trim;
+          return meanOf(sorted, trim, _count - trim);
+        }
+
+        case Hampel:
+          return hampel(sorted);
+
+        default:
+          assert(false);
+          return meanOf(sorted, 0, _count);
+      }
+    }
+};
+
+#endif // __SAMPLE_FILTER_H__
@@ -0,0 +1,179 @@
+#ifndef __SAMPLE_HISTORY_H__
+#define __SAMPLE_HISTORY_H__
+
+/*
+ * SampleHistory.h - Keeps the most recent samples in a fixed capacity RAM ring buffer.
+ *
+ * Each iteration of 'loop()' appends one 'Sample'.  Once the buffer is full, the oldest
+ * sample is overwritten.  The buffer is statically sized so that keeping history never
+ * allocates from the heap.
+ *
+ * Rolling statistics of each channel's temperature are maintained as samples are added (see
+ * WindowedStats.h), so consumers never need to rescan the history.  Statistics are kept over
+ * two windows at once: a short-term window (e.g., the last minute) and a long-term window
+ * (e.g., the whole history.)  Both are limited to the '_capacity' most recent samples.
+ *
+ * Each window of each channel takes ~750 bytes of RAM, so statistics are only kept for the
+ * first SAMPLE_HISTORY_STATS_CHANNELS channels (by default, the pool and the collector.)
+ */
+
+#include <assert.h>
+#include <Print.h>
+#include <TimeLib.h>
+#include "Device.h"
+#include "WindowedStats.h"
+
+#ifndef SAMPLE_HISTORY_STATS_CHANNELS
+#define SAMPLE_HISTORY_STATS_CHANNELS 2
+#endif
+
+// A single temperature sample, as logged to Firebase (plus local diagnostics.)
+struct Sample {
+  time_t  time;                               // UTC timestamp of the sample (whole seconds)
+  uint16_t millis;                            // Milliseconds part of the timestamp [0..999]
+  uint8_t channels;                           // Number of valid entries in the arrays below
+  float   adc[Device::_max_channels];         // Filtered raw ADC value of each channel [0..1023]
+  float   celsius[Device::_max_channels];     // Corresponding temperature of each channel (in Celsius)
+  uint8_t rejected[Device::_max_channels];    // Number of raw ADC samples rejected by 'SampleFilter'
+  bool    active;                             // True if the collector was engaged
+};
+
+class SampleHistory {
+  public:
+    // The maximum number of samples retained.  (At the default 5 second polling rate this is
+    // the last 5 minutes.)
+    static const uint16_t _capacity = 60;
+
+    // The number of channels (starting at channel 0) with rolling statistics.
+    static const int _stats_channels = SAMPLE_HISTORY_STATS_CHANNELS;
+    static_assert(0 < _stats_channels && _stats_channels <= Device::_max_channels,
+      "SAMPLE_HISTORY_STATS_CHANNELS must be in [1..Device::_max_channels].");
+
+    // The windows over which rolling statistics are kept.  (See 'setStatsWindow()'.)
+    enum StatsWindow : uint8_t { ShortTerm, LongTerm };
+    static const uint8_t _stats_windows = 2;
+
+  private:
+    Sample   _samples[_capacity];
+    uint16_t _next  = 0;                      // Index of the slot that will be written next
+    uint16_t _count = 0;                      // Number of valid samples [0.._capacity]
+
+    WindowedStats<_capacity> _stats[_stats_channels][_stats_windows];   // Rolling temperature statistics per channel and window
+    uint8_t _channels = 0;                    // Number of channels in the most recent sample
+
+    // Returns the number of the first 'channels' channels that have statistics.  (Compares by
+    // value, as 'min()' taking '_stats_channels' by reference would require a definition.)
+    static int statsChannels(int channels) {
+      return channels < _stats_channels ? channels : _stats_channels;
+    }
+
+    // Writes the members of a JSON object with the rolling statistics of each channel over
+    // 'window', keyed by channel.  (Only channels with statistics are included.)
+    void printStatsMembersTo(Print& out, StatsWindow window) const {
+      out.print("\"window\":"); out.print(_stats[0][window].window());
+      for (int channel = 0; channel < statsChannels(_channels); channel++) {
+        out.print(",\""); out.print(channel); out.print("\":");
+        _stats[channel][window].printTo(out);
+      }
+    }
+
+  public:
+    // Appends 'sample', overwriting the oldest sample if the buffer is full.
+    void add(const Sample& sample) {
+      // If the number of channels changed, the statistics of any channel that is no longer
+      // sampled are stale.
+      for (int channel = sample.channels; channel < statsChannels(_channels); channel++) {
+        for (uint8_t window = 0; window < _stats_windows; window++) {
+          _stats[channel][window].clear();
+        }
+      }
+      _channels = sample.channels;
+
+      for (int channel = 0; channel < statsChannels(sample.channels); channel++) {
+        for (uint8_t window = 0; window < _stats_windows; window++) {
+          _stats[channel][window].add(sample.celsius[channel]);
+        }
+      }
+
+      _samples[_next] = sample;
+      _next = (_next + 1) % _capacity;
+      if (_count < _capacity) {
+        _count++;
+      }
+    }
+
+    uint16_t count() const    { return _count; }
+    uint16_t capacity() const { return _capacity; }
+
+    // Returns the sample 'age' entries before the most recent one (i.e., 'at(0)' is the
+    // most recent sample.)
+    const Sample& at(uint16_t age) const {
+      assert(age < _count);
+      return _samples[(_next + _capacity - 1 - age) % _capacity];
+    }
+
+    // Sets the number of most recent samples included in the rolling statistics of 'window'.
+    // [1.._capacity]
+    void setStatsWindow(StatsWindow window, uint16_t samples) {
+      for (int channel = 0; channel < _stats_channels; channel++) {
+        _stats[channel][window].setWindow(samples);
+      }
+    }
+
+    // Rolling temperature statistics (in Celsius) of the given 'channel' over 'window'.
+    // [0.._stats_channels)
+    const WindowedStats<_capacity>& stats(int channel, StatsWindow window = ShortTerm) const {
+      assert(0 <= channel && channel < _stats_channels);
+      return _stats[channel][window];
+    }
+
+    // Writes 'sample' as a JSON object using the same property names as the Firebase log.
+    // ('rejected' is only available locally.)
+    static void printSampleTo(Print& out, const Sample& sample) {
+      // The timestamp is printed in seconds (with a millisecond fraction), as in the Firebase log.
+      out.print("{\"time\":"); out.print(static_cast<uint32_t>(sample.time));
+      out.print(sample.millis < 10 ? ".00" : sample.millis < 100 ? ".0" : "."); out.print(sample.millis);
+      for (int channel = 0; channel < sample.channels; channel++) {
+        out.print(",\""); out.print(channel); out.print("\":"); out.print(sample.adc[channel]);
+      }
+      out.print(",\"active\":"); out.print(sample.active ? "true" : "false");
+      out.print(",\"rejected\":[");
+      for (int channel = 0; channel < sample.channels; channel++) {
+        if (channel > 0) {
+          out.print(",");
+        }
+        out.print(sample.rejected[channel]);
+      }
+      out.print("]");
+      out.print("}");
+    }
+
+    // Writes the most recent 'maxCount' samples as a JSON array, oldest first.  Written
+    // directly to 'out' so that large snapshots do not require a JsonBuffer.
+    void printTo(Print& out, uint16_t maxCount) const {
+      uint16_t n = maxCount < _count ? maxCount : _count;
+
+      out.print("[");
+      for (uint16_t age = n; age-- > 0;) {
+        printSampleTo(out, at(age));
+        if (age > 0) {
+          out.print(",");
+        }
+      }
+      out.print("]");
+    }
+
+    // Writes the short-term statistics as a JSON object keyed by channel, with the long-term
+    // statistics nested under 'long', e.g.:
+    //
+    //    {"window":12,"0":{...},"1":{...},"long":{"window":60,"0":{...},"1":{...}}}
+    void printStatsTo(Print& out) const {
+      out.print("{");
+      printStatsMembersTo(out, ShortTerm);
+      out.print(",\"long\":{");
+      printStatsMembersTo(out, LongTerm);
+      out.print("}}");
+    }
+};
+
+#endif // __SAMPLE_HISTORY_H__
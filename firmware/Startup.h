@@ -0,0 +1,156 @@
+#ifndef __STARTUP_H__
+#define __STARTUP_H__
+
+/*
+ * Startup.h - Brings up WiFi, the local server, Firebase, cloud config and NTP in the
+ *             background while the main loop samples and controls the collector.
+ *
+ * Bring-up proceeds through the following states.  Each call to 'poll()' does at most one
+ * step of work and returns, so that the caller can interleave it with sampling:
+ *
+ *    ConnectingWifi      - Waiting for 'Network' to connect.  (Starts the local server
+ *                          and Firebase client once connected.)
+ *    UpdatingConfig      - Retrying 'CloudStorage::update()' until it succeeds.  (Caches
+ *                          the retrieved config in flash and starts NTP using the
+ *                          retrieved server once successful.  An incomplete or invalid
+ *                          config is neither applied nor cached, and is retried until
+ *                          corrected in Firebase.)
+ *    SynchronizingClock  - Waiting for the first NTP response.
+ *    Ready               - Samples may be logged to Firebase with valid timestamps.
+ *
+ * Until the cloud config arrives, the main loop makes its decisions using the configuration
+ * 'CloudStorage' already holds.  (i.e., the copy cached in flash on a previous boot, if any.)
+ */
+
+#include "Device.h"
+#include "LocalStorage.h"
+#include "Network.h"
+#include "CloudStorage.h"
+#include "NTPTime.h"
+#include "LocalServer.h"
+#include "SampleHistory.h"
+#include "Log.h"
+#include "Trace.h"
+
+class Startup {
+  public:
+    enum State : uint8_t { ConnectingWifi, UpdatingConfig, SynchronizingClock, Ready };
+
+  private:
+    // Delay between failed attempts to retrieve the cloud config.
+    static const uint32_t _update_retry_millis = 2000;
+
+    State _state = ConnectingWifi;
+    uint32_t _started_millis = 0;             // 'millis()' when 'begin()' was called
+    uint32_t _next_update_millis = 0;         // 'millis()' of the next 'CloudStorage::update()' attempt
+    bool _config_updated = false;             // True if config was retrieved since the last 'takeConfigUpdate()'
+
+    Device* _device;
+    LocalStorage* _local;
+    Network* _network;
+    CloudStorage* _cloud;
+    NTPTime* _ntp;
+    LocalServer* _server;
+    const SampleHistory* _history;
+
+    // Logs the completion of a step along with the time since 'begin()'.
+    void logStep(const __FlashStringHelper* step) {
+      LOGLN(MAIN, INFO, F("Startup: "), step, F(" (+"), millis() - _started_millis, F("ms)"));
+    }
+
+  public:
+    // Begins connecting to WiFi (or opens the captive portal if the device has no saved WiFi
+    // settings) and returns immediately.  (See 'Network::begin()'.)
+    void begin(
+      Device& device,
+      LocalStorage& local,
+      Network& network,
+      CloudStorage& cloud,
+      NTPTime& ntp,
+      LocalServer& server,
+      const SampleHistory& history
+    ) {
+      _device = &device;
+      _local = &local;
+      _network = &network;
+      _cloud = &cloud;
+      _ntp = &ntp;
+      _server = &server;
+      _history = &history;
+
+      _started_millis = millis();
+      TRACE_BEGIN(WifiConnect);
+      _network->begin(device, local);
+    }
+
+    // Advances bring-up by at most one step.
+    void poll() {
+      switch (_state) {
+        case ConnectingWifi:
+          if (!_network->poll(*_device, *_local)) {
+            return;
+          }
+
+          TRACE_END(WifiConnect);
+          logStep(F("WiFi connected"));
+          _server->init(*_history);
+          _cloud->init(_local->getFirebaseHost(), _local->getFirebaseAuth());
+          _state = UpdatingConfig;
+          TRACE_BEGIN(ConfigUpdate);
+          break;
+
+        case UpdatingConfig:
+          if (static_cast<int32_t>(millis() - _next_update_millis) < 0) {
+            return;
+          }
+
+          if (!_cloud->update(*_device)) {
+            _next_update_millis = millis() + _update_retry_millis;
+            return;
+          }
+
+          TRACE_END(ConfigUpdate);
+          logStep(F("Cloud config updated"));
+          _cloud->saveCached(*_local);
+          _config_updated = true;
+          _ntp->begin(_cloud->getNtpServer(), _cloud->getGmtOffset());
+          _state = SynchronizingClock;
+          TRACE_BEGIN(NtpWait);
+          break;
+
+        case SynchronizingClock:
+          if (!_ntp->poll()) {
+            return;
+          }
+
+          TRACE_END(NtpWait);
+          logStep(F("Clock synchronized"));
+          _state = Ready;
+
+#if TRACE_ENABLED
+          // Print the boot timeline.  (Written through, blocking, as it is larger than the
+          // log's ring.)
+          _log.setAsync(false);
+          _trace.printTo(_log);
+          _log.setAsync(true);
+#endif
+          break;
+
+        case Ready:
+          break;
+      }
+    }
+
+    // Returns true (once) after each successful retrieval of the cloud config, so the caller
+    // can apply it at a convenient point (i.e., between polling periods.)
+    bool takeConfigUpdate() {
+      bool updated = _config_updated;
+      _config_updated = false;
+      return updated;
+    }
+
+    State getState() const  { return _state; }
+    bool isReady() const    { return _state == Ready; }
+};
+
+#endif // __STARTUP_H__
@@ -0,0 +1,174 @@
+#ifndef __SWINGING_DOOR_H__
+#define __SWINGING_DOOR_H__
+
+/*
+ * SwingingDoor.h - Drops logged samples that lie on the trend of their neighbours.
+ *
+ * A variant of swinging door trending: the stream of samples is reduced to the points at
+ * which a straight line from the last logged sample (the 'anchor') can no longer pass within
+ * each channel's deviation (in Celsius) of every sample since.  Linearly interpolating the
+ * temperatures between consecutive logged samples therefore reconstructs every dropped
+ * sample to within its channel's deviation.
+ *
+ * Each channel keeps the range of slopes from the anchor that pass within the deviation of
+ * every sample since (the 'doors').  A new sample extends the current segment if the slope
+ * from the anchor to it lies within every channel's doors.  Otherwise the previous sample
+ * (the 'held' sample) ends the segment: it is logged, becomes the new anchor, and the doors
+ * reopen.  (Classic swinging door trending instead checks only that the doors have not yet
+ * closed, which can exceed the deviation at the samples between anchors.)
+ *
+ * A change of the relay's state (or of the number of channels) always ends the segment at
+ * the held sample and logs the new sample, so transitions are logged exactly.
+ *
+ * The held sample is only logged once the segment ends (or on 'flush()').  With every
+ * channel's deviation at 0 (the default), every sample is logged as it is added.
+ *
+ * The host test tools/swingdoortest.cpp checks the error bound on random sample streams.
+ */
+
+#include <math.h>
+#include "Device.h"
+#include "SampleHistory.h"
+
+class SwingingDoor {
+  private:
+    float  _deviation[Device::_max_channels] = { 0 };   // Tolerance of each channel (in Celsius)
+
+    Sample _anchor;                           // Last logged sample (start of the current segment)
+    Sample _held;                             // Most recent sample, if not yet logged
+    bool   _has_anchor = false;
+    bool   _has_held = false;
+    uint32_t _discarded = 0;                  // Held samples replaced (or reset) without being logged
+
+    // Range of slopes (in Celsius per second) from '_anchor' that pass within the deviation
+    // of every sample since.
+    float  _min_slope[Device::_max_channels];
+    float  _max_slope[Device::_max_channels];
+
+    // Seconds from '_anchor' to 'sample'.  (Negative if the clock was stepped back.  Signed
+    // whether or not 'time_t' is.)
+    float secondsSinceAnchor(const Sample& sample) const {
+      return static_cast<float>(static_cast<int64_t>(sample.time) - static_cast<int64_t>(_anchor.time))
+        + (static_cast<int>(sample.millis) - static_cast<int>(_anchor.millis)) / 1000.0f;
+    }
+
+    bool isCompressing() const {
+      for (int channel = 0; channel < Device::_max_channels; channel++) {
+        if (_deviation[channel] > 0) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Starts a new segment at 'sample', which the caller logs.
+    void anchor(const Sample& sample) {
+      _anchor = sample;
+      _has_anchor = true;
+      _has_held = false;
+      for (int channel = 0; channel < Device::_max_channels; channel++) {
+        _min_slope[channel] = -INFINITY;
+        _max_slope[channel] = INFINITY;
+      }
+    }
+
+    // True if the line from '_anchor' to 'sample' passes within the deviation of every
+    // sample since '_anchor'.
+    bool extends(const Sample& sample, float seconds) const {
+      for (int channel = 0; channel < sample.channels; channel++) {
+        float slope = (sample.celsius[channel] - _anchor.celsius[channel]) / seconds;
+        if (slope < _min_slope[channel] || slope > _max_slope[channel]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Narrows the doors to the slopes passing within the deviation of 'sample'.
+    void narrow(const Sample& sample, float seconds) {
+      for (int channel = 0; channel < sample.channels; channel++) {
+        float change = sample.celsius[channel] - _anchor.celsius[channel];
+        _min_slope[channel] = fmaxf(_min_slope[channel], (change - _deviation[channel]) / seconds);
+        _max_slope[channel] = fminf(_max_slope[channel], (change + _deviation[channel]) / seconds);
+      }
+    }
+
+  public:
+    // Sets the maximum reconstruction error of the given channel (in Celsius).
+    void setDeviation(int channel, float celsius) {
+      _deviation[channel] = celsius;
+    }
+
+    // Adds the next sample of the stream.  Copies the samples to log (oldest first) to 'out'
+    // and returns their number [0..2].
+    uint8_t add(const Sample& sample, Sample out[2]) {
+      if (!_has_anchor) {
+        anchor(sample);
+        out[0] = sample;
+        return 1;
+      }
+
+      float seconds = secondsSinceAnchor(sample);
+      bool boundary = !isCompressing()
+        || sample.active != _anchor.active
+        || sample.channels != _anchor.channels
+        || seconds <= 0;                      // (E.g., the clock was stepped back)
+
+      if (!boundary && extends(sample, seconds)) {
+        narrow(sample, seconds);
+        if (_has_held) {
+          _discarded++;
+        }
+        _held = sample;
+        _has_held = true;
+        return 0;
+      }
+
+      // End the segment at the held sample (which is within the doors), if any.
+      uint8_t count = 0;
+      if (_has_held) {
+        out[count++] = _held;
+        anchor(_held);
+        seconds = secondsSinceAnchor(sample);
+      }
+
+      if (boundary || seconds <= 0) {
+        anchor(sample);
+        out[count++] = sample;
+      } else {
+        // The new segment begins with 'sample' held.  (With no samples between the anchor
+        // and 'sample', the line to it trivially extends the segment.)
+        narrow(sample, seconds);
+        _held = sample;
+        _has_held = true;
+      }
+      return count;
+    }
+
+    // Ends the current segment.  Returns true (and copies the held sample to 'out') if there
+    // is a sample not yet logged.
+    bool flush(Sample& out) {
+      if (!_has_held) {
+        return false;
+      }
+
+      out = _held;
+      anchor(_held);
+      return true;
+    }
+
+    // Discards the current segment.  The next sample added is logged.
+    void reset() {
+      if (_has_held) {
+        _discarded++;
+      }
+      _has_anchor = false;
+      _has_held = false;
+    }
+
+    // Returns the number of samples dropped (i.e., that will never be logged.)  A held sample
+    // is only counted once a later sample replaces it.
+    uint32_t getDiscarded() const   { return _discarded; }
+};
+
+#endif // __SWINGING_DOOR_H__
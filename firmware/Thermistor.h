@@ -15,6 +15,8 @@
  * 'ThermistorReading' struct.
  */
 
+#include "Log.h"
+
 class ThermistorReading {
   public:
     const double _adc;                        // Raw ADC reading [0..1023]
@@ -24,10 +26,11 @@ class ThermistorReading {
     ThermistorReading(double adc, double resistance, double celsius)
       : _adc(adc), _resistance(resistance), _celsius(celsius) { }
 
-    void print() {
+    // Logs the reading of the given mux 'channel'.
+    void print(int channel) {
       double fahrenheit = _celsius * 1.8 + 32.0;
       
-      Serial.print("adc = "); Serial.print(_adc); Serial.print(" r = "); Serial.print(_resistance); Serial.print(" C = "); Serial.print(_celsius); Serial.print(" F = "); Serial.println(fahrenheit);
+      LOG_TOKEN(SENSOR, DEBUG, LogToken::Reading, channel, _adc, _resistance, _celsius, fahrenheit);
     }
 };
 
@@ -77,6 +80,19 @@ class Thermistor {
       double celsius = resistanceToCelsius(resistance);
       return ThermistorReading(adc, resistance, celsius);
     }
+
+    // Returns the change in temperature (in Celsius) corresponding to a 1 LSB change in the
+    // ADC reading near 'adc'.  (The magnitude varies along the thermistor curve.)
+    double celsiusPerLsb(double adc) {
+      double lo = adc - 0.5;
+      double hi = adc + 0.5;
+
+      // Stay within the open interval (0..1023), where 'adcToResistance()' is finite.
+      if (lo < 0.5)     { lo = 0.5;    hi = 1.5; }
+      if (hi > 1022.5)  { lo = 1021.5; hi = 1022.5; }
+
+      return resistanceToCelsius(adcToResistance(hi)) - resistanceToCelsius(adcToResistance(lo));
+    }
 };
 
 #endif // __THERMISTOR_H__
@@ -0,0 +1,164 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * Trace.h - Records a timeline of boot and main loop activity for viewing in Perfetto.
+ *
+ * When built with TRACE_ENABLED=1, TRACE_BEGIN()/TRACE_END() (or TRACE_SCOPE()) record
+ * begin/end events with 'micros()' timestamps into a fixed size RAM buffer.  Recording
+ * stops once the buffer is full (so that boot is always captured) until 'clear()' is called.
+ * The buffer is printed to the serial monitor once startup completes, and can be fetched
+ * at any time from:
+ *
+ *    http://<device-ip>/trace[?clear]      - (Optionally clears the buffer after printing.)
+ *
+ * The host tool tools/trace2json.cpp converts the printed events (which may be mixed with
+ * other serial output) to Chrome trace event JSON.
+ *
+ * Each event name belongs to a track (shown as a thread in the viewer.)  Spans on the same
+ * track must nest, so bring-up steps that span many loop iterations (e.g., waiting for WiFi)
+ * are on the 'Startup' track rather than the 'Main' track.
+ *
+ * With TRACE_ENABLED=0 (the default), the macros compile to nothing.
+ */
+
+#include <pgmspace.h>
+#include <Print.h>
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 0
+#endif
+
+// Traced spans and the track each is shown on.  (Append new events at the end.)
+#define TRACE_EVENTS(X)                   \
+  X(Setup,            Main)               \
+  X(DeviceInit,       Main)               \
+  X(SpiffsMount,      Main)               \
+  X(LoadCachedConfig, Main)               \
+  X(Loop,             Main)               \
+  X(TakeSample,       Main)               \
+  X(Publish,          Main)               \
+  X(Upload,           Main)               \
+  X(CloudLog,         Main)               \
+  X(CloudUpdate,      Main)               \
+  X(WifiConnect,      Startup)            \
+  X(ConfigUpdate,     Startup)            \
+  X(NtpWait,          Startup)
+
+enum class TraceEvent : uint8_t {
+  #define TRACE_EVENT_ENUM(name, track) name,
+  TRACE_EVENTS(TRACE_EVENT_ENUM)
+  #undef TRACE_EVENT_ENUM
+
+  Count
+};
+
+enum class TraceTrack : uint8_t { Main = 1, Startup = 2 };
+
+class Trace {
+  private:
+    // Maximum number of events recorded.  (8 bytes each.)
+    static const uint16_t _capacity = 256;
+
+    struct Event {
+      uint32_t micros;                        // 'micros()' when the event was recorded
+      TraceEvent name;
+      char phase;                             // 'B'egin or 'E'nd (as in the Chrome format)
+    };
+
+    Event    _events[_capacity];
+    uint16_t _count = 0;                      // Number of events recorded
+    uint32_t _dropped = 0;                    // Events discarded since the buffer filled
+
+    void record(TraceEvent name, char phase) {
+      if (_count >= _capacity) {
+        _dropped++;
+        return;
+      }
+
+      _events[_count++] = { static_cast<uint32_t>(micros()), name, phase };
+    }
+
+    static const __FlashStringHelper* nameOf(TraceEvent name) {
+      #define TRACE_EVENT_NAME(name, track) static const char name_##name[] PROGMEM = #name;
+      TRACE_EVENTS(TRACE_EVENT_NAME)
+      #undef TRACE_EVENT_NAME
+
+      static PGM_P const names[] = {
+        #define TRACE_EVENT_NAME(name, track) name_##name,
+        TRACE_EVENTS(TRACE_EVENT_NAME)
+        #undef TRACE_EVENT_NAME
+      };
+      return reinterpret_cast<const __FlashStringHelper*>(names[static_cast<uint8_t>(name)]);
+    }
+
+    static TraceTrack trackOf(TraceEvent name) {
+      static const TraceTrack tracks[] = {
+        #define TRACE_EVENT_TRACK(name, track) TraceTrack::track,
+        TRACE_EVENTS(TRACE_EVENT_TRACK)
+        #undef TRACE_EVENT_TRACK
+      };
+      return tracks[static_cast<uint8_t>(name)];
+    }
+
+  public:
+    void begin(TraceEvent name)   { record(name, 'B'); }
+    void end(TraceEvent name)     { record(name, 'E'); }
+
+    // Discards the recorded events and resumes recording.
+    void clear() {
+      _count = 0;
+      _dropped = 0;
+    }
+
+    // Prints the recorded events, one per line:
+    //
+    //    @track <track> <name>
+    //    @<micros> <phase> <track> <name>
+    //
+    // (The '@' prefix lets tools/trace2json.cpp pick the events out of other serial output.)
+    void printTo(Print& out) const {
+      out.print(F("@track ")); out.print(static_cast<uint8_t>(TraceTrack::Main)); out.println(F(" Main"));
+      out.print(F("@track ")); out.print(static_cast<uint8_t>(TraceTrack::Startup)); out.println(F(" Startup"));
+
+      for (uint16_t i = 0; i < _count; i++) {
+        const Event& event = _events[i];
+        out.print('@'); out.print(event.micros);
+        out.print(' '); out.print(event.phase);
+        out.print(' '); out.print(static_cast<uint8_t>(trackOf(event.name)));
+        out.print(' '); out.println(nameOf(event.name));
+      }
+
+      if (_dropped > 0) {
+        out.print(F("@dropped ")); out.println(_dropped);
+      }
+    }
+
+    uint16_t count() const        { return _count; }
+    uint32_t getDropped() const   { return _dropped; }
+};
+
+#if TRACE_ENABLED
+// Defined in firmware.ino.
+extern Trace _trace;
+
+// Ends the span when it goes out of scope.  (See TRACE_SCOPE().)
+class TraceScope {
+  private:
+    TraceEvent _name;
+
+  public:
+    TraceScope(TraceEvent name) : _name(name)   { _trace.begin(_name); }
+    ~TraceScope()                               { _trace.end(_name); }
+};
+
+#define TRACE_BEGIN(name)   _trace.begin(TraceEvent::name)
+#define TRACE_END(name)     _trace.end(TraceEvent::name)
+#define TRACE_SCOPE(name)   TraceScope _trace_scope_##name(TraceEvent::name)
+#else
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_SCOPE(name)
+#endif
+
+#endif // __TRACE_H__
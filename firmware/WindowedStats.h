@@ -0,0 +1,178 @@
+#ifndef __WINDOWED_STATS_H__
+#define __WINDOWED_STATS_H__
+
+/*
+ * WindowedStats.h - Rolling mean, variance, min and max over the most recent 'window'
+ *                   values, updated in O(1) (amortized) per value.
+ *
+ * The mean and variance are maintained incrementally using Welford's algorithm, which
+ * supports both adding the newest value and removing the oldest value as it leaves the
+ * window.  (See https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Welford's_online_algorithm)
+ *
+ * The min and max are maintained with monotonic deques of the values still inside the
+ * window.  Each value is pushed and popped at most once, so the cost is amortized O(1).
+ *
+ * 'Capacity' is the largest supported window.  All storage is statically allocated.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <Print.h>
+
+template <uint16_t Capacity> class WindowedStats {
+  private:
+    // A fixed capacity double-ended queue of value sequence numbers.
+    class Deque {
+      private:
+        uint32_t _items[Capacity];
+        uint16_t _head = 0;
+        uint16_t _size = 0;
+
+      public:
+        bool empty() const        { return _size == 0; }
+        uint32_t front() const    { assert(_size > 0); return _items[_head]; }
+        uint32_t back() const     { assert(_size > 0); return _items[(_head + _size - 1) % Capacity]; }
+        void popFront()           { assert(_size > 0); _head = (_head + 1) % Capacity; _size--; }
+        void popBack()            { assert(_size > 0); _size--; }
+        void pushBack(uint32_t seq) {
+          assert(_size < Capacity);
+          _items[(_head + _size) % Capacity] = seq;
+          _size++;
+        }
+        void clear()              { _head = 0; _size = 0; }
+    };
+
+    float    _values[Capacity];               // Value with sequence number 's' is at '_values[s % Capacity]'
+    uint32_t _next_seq = 0;                   // Sequence number assigned to the next value added
+    uint16_t _count = 0;                      // Number of values currently inside the window
+    uint16_t _window = Capacity;              // Maximum number of values inside the window
+
+    double   _mean = 0;                       // Running mean of the values inside the window
+    double   _m2 = 0;                         // Running sum of squared deviations from '_mean'
+
+    Deque    _min;                            // Sequence numbers with strictly increasing values
+    Deque    _max;                            // Sequence numbers with strictly decreasing values
+
+    float valueAt(uint32_t seq) const { return _values[seq % Capacity]; }
+
+    // Removes the oldest value from the window.
+    void evict() {
+      assert(_count > 0);
+
+      uint32_t seq = _next_seq - _count;
+      double x = valueAt(seq);
+
+      _count--;
+      if (_count == 0) {
+        _mean = 0;
+        _m2 = 0;
+      } else {
+        double delta = x - _mean;
+        _mean -= delta / _count;
+        _m2 -= delta * (x - _mean);
+      }
+
+      if (!_min.empty() && _min.front() == seq) { _min.popFront(); }
+      if (!_max.empty() && _max.front() == seq) { _max.popFront(); }
+    }
+
+    // Recomputes '_mean' and '_m2' from the values inside the window.  Called periodically
+    // to discard rounding error accumulated by repeatedly adding/removing values.
+    void recompute() {
+      double mean = 0;
+      double m2 = 0;
+      uint32_t n = 0;
+
+      for (uint32_t seq = _next_seq - _count; seq != _next_seq; seq++) {
+        double x = valueAt(seq);
+        n++;
+        double delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+      }
+
+      _mean = mean;
+      _m2 = m2;
+    }
+
+  public:
+    // Sets the number of most recent values included in the statistics [1..Capacity].
+    // Shrinking the window immediately discards the oldest values.
+    void setWindow(uint16_t window) {
+      _window = window < 1
+        ? 1
+        : window > Capacity
+          ? Capacity
+          : window;
+
+      while (_count > _window) {
+        evict();
+      }
+    }
+
+    // Adds 'x' as the newest value, evicting the oldest value if the window is full.
+    void add(float x) {
+      if (_count == _window) {
+        evict();
+      }
+
+      uint32_t seq = _next_seq++;
+      _values[seq % Capacity] = x;
+      _count++;
+
+      double delta = x - _mean;
+      _mean += delta / _count;
+      _m2 += delta * (x - _mean);
+
+      while (!_min.empty() && valueAt(_min.back()) >= x) { _min.popBack(); }
+      _min.pushBack(seq);
+
+      while (!_max.empty() && valueAt(_max.back()) <= x) { _max.popBack(); }
+      _max.pushBack(seq);
+
+      if (seq % (Capacity * 16u) == 0) {
+        recompute();
+      }
+    }
+
+    void clear() {
+      _next_seq = 0;
+      _count = 0;
+      _mean = 0;
+      _m2 = 0;
+      _min.clear();
+      _max.clear();
+    }
+
+    uint16_t count() const  { return _count; }
+    uint16_t window() const { return _window; }
+    double mean() const     { return _mean; }
+
+    // Unbiased sample variance of the values inside the window (0 if fewer than two values.)
+    double variance() const {
+      return _count > 1 && _m2 > 0
+        ? _m2 / (_count - 1)
+        : 0;
+    }
+
+    double stddev() const   { return sqrt(variance()); }
+    float min() const       { return _min.empty() ? NAN : valueAt(_min.front()); }
+    float max() const       { return _max.empty() ? NAN : valueAt(_max.front()); }
+
+    // Writes the statistics as a JSON object.
+    void printTo(Print& out) const {
+      out.print("{\"count\":"); out.print(_count);
+      if (_count == 0) {
+        out.print("}");
+        return;
+      }
+
+      out.print(",\"mean\":"); out.print(mean());
+      out.print(",\"stddev\":"); out.print(stddev());
+      out.print(",\"min\":"); out.print(min());
+      out.print(",\"max\":"); out.print(max());
+      out.print("}");
+    }
+};
+
+#endif // __WINDOWED_STATS_H__
@@ -11,55 +11,299 @@
 #include "CloudStorage.h"
 #include "Thermistor.h"
 #include "NTPTime.h"
+#include "SampleHistory.h"
+#include "LocalServer.h"
+#include "SampleFilter.h"
+#include "AdaptiveOversample.h"
+#include "AdaptivePolling.h"
+#include "SwingingDoor.h"
+#include "Startup.h"
+#include "DeepSleep.h"
+#include "EventQueue.h"
+#include "Radio.h"
+#include "MonotonicClock.h"
+#include "Log.h"
+#include "Console.h"
+#include "Metrics.h"
+#include "MetricNames.h"
+#include "Trace.h"
 
+Log _log;                 // Buffered diagnostic output to the serial monitor.  (Defined first, as
+                          //   other globals may log during construction.)
+Metrics _metrics;         // Registry of the metrics served at '/metrics'.  (See Metrics.h.)
+#if TRACE_ENABLED
+Trace _trace;             // Timeline of boot and main loop activity.  (See Trace.h.)
+#endif
 Device _device;           // I/O driver for the hardware device (set relay state, set LED state, etc.)
 CloudStorage _cloud;      // Load/store data in the Firebase realtime database.
-Thermistor _thermistor;   // For converting ADC values to temperatures.
+SampleHistory _history;   // Most recent samples, served by '_server'.
+LocalServer _server;      // Serves live telemetry over HTTP/WebSocket on the local network.
+LocalStorage _local;      // WiFi and Firebase settings saved in flash.
+Network _network;         // WiFi connection (and captive portal for configuring settings.)
+NTPTime _ntp;             // Synchronizes the 'Time' library with an NTP server.
+Startup _startup;         // Brings up the network, cloud config and clock in the background.
+DeepSleep _sleep;         // Duty cycles the device while the collector is idle.
+Radio _radio;             // Powers the radio down between uploads.
+MonotonicClock _clock;    // Strictly increasing sample timestamps, disciplined by NTP.
+uint16_t _pending = 0;    // Number of the most recent samples in '_history' not yet logged.  (Samples
+                          //   batched during deep sleep are instead kept by '_sleep' until logged.)
+EventQueue _events;       // Events logged ahead of the pending samples.
+bool _below_minimum = false;  // True while a temperature is below 'minTOn'.
+bool _radio_connected = false;  // '_radio.isConnected()' as of the last iteration of 'wait()'.
+AdaptivePolling _polling; // Chooses each polling period from the distance to the next relay change.
+SwingingDoor _compression;  // Drops logged samples within 'compressionDeviation' of the trend.
+Console _console;         // Commands typed into the serial monitor.  (See 'runHelp()', etc.)
+
+// Requests made by console commands, handled at the next convenient point in 'loop()'.
+bool _flush_requested = false;      // Upload pending samples now, regardless of 'uploadEvery'
+bool _resync_requested = false;     // Synchronize '_clock' now, even if not due
+bool _config_overridden = false;    // A setting was changed with 'set', re-apply the config
+
+// Number of consecutive idle periods before the device begins to deep sleep.
+const uint8_t _idle_periods_before_sleep = 3;
+
+// Per-channel sampling pipeline.  Only the first '_cloud.getChannels()' entries are used.
+Thermistor _thermistor[Device::_max_channels];            // Converts each channel's ADC values to temperatures.
+SampleFilter _filter[Device::_max_channels];              // Combines each channel's raw ADC samples, rejecting outliers.
+AdaptiveOversample _oversample[Device::_max_channels];    // Chooses each channel's sample count from its measured noise.
+double _last_adc[Device::_max_channels];                  // Each channel's filtered ADC value from the previous period.
+
+// Bucket bounds (in seconds) of '_actuation_latency_metric'.
+const float _actuation_latency_bounds[] = { 1, 2, 5, 10, 20, 30, 60, 120 };
+
+// 'millis()' at the end of the last sample window in which the delta had not crossed the
+// threshold for changing the relay.  (i.e., the earliest the crossing can have occurred.)
+uint32_t _uncrossed_millis = 0;
+
+// Bucket bounds (in seconds) of the queueing delay of events and samples before being logged.
+const float _event_queue_bounds[] = { 0.5, 1, 2, 5, 10, 30, 60 };
+const float _sample_queue_bounds[] = { 1, 10, 60, 300, 900, 3600, 14400 };
+
+// Metrics served at '/metrics'.  (Metrics of the cloud uploads are kept by '_cloud'.  Names and
+// help text are in MetricNames.h.)
+Counter _samples_metric { METRIC(samples) };
+Counter _compressed_metric { METRIC(compressed),
+  [](){ return _compression.getDiscarded(); } };
+Counter _adc_reads_metric { METRIC(adc_reads) };
+Counter _relay_transitions_metric { METRIC(relay_transitions),
+  [](){ return _device.getRelayTransitions(); } };
+Counter _relay_faults_metric { METRIC(relay_faults),
+  [](){ return _device.getRelayFaults(); } };
+Gauge _relay_closed_metric { METRIC(relay_closed),
+  [](){ return _device.getRelay() ? 1.0f : 0.0f; } };
+Counter _log_dropped_metric { METRIC(log_dropped),
+  [](){ return _log.getDropped(); } };
+Gauge _heap_metric { METRIC(heap),
+  [](){ return static_cast<float>(ESP.getFreeHeap()); } };
+Gauge _rssi_metric { METRIC(rssi),
+  [](){ return WiFi.status() == WL_CONNECTED ? static_cast<float>(WiFi.RSSI()) : 0.0f; } };
+Gauge _uptime_metric { METRIC(uptime),
+  [](){ return static_cast<float>(_clock.micros64() / 1000000); } };
+Gauge _polling_period_metric { METRIC(polling_period),
+  [](){ return _polling.getPeriodMillis() / 1000.0f; } };
+Histogram<8> _actuation_latency_metric { METRIC(actuation_latency), _actuation_latency_bounds };
+Histogram<7> _event_queue_metric { METRIC(event_queue), _event_queue_bounds };
+Histogram<7> _sample_queue_metric { METRIC(sample_queue), _sample_queue_bounds };
+Counter _events_dropped_metric { METRIC(events_dropped),
+  [](){ return _events.getDropped(); } };
+
+// Delays for the given number of milliseconds while continuing to service background
+// work (e.g., bring-up of the network, clients of '_server').
+void wait(uint32_t milliseconds) {
+  uint32_t start = millis();
+  do {
+    _log.drain();
+    _console.poll();
+    _clock.poll();
+    _local.poll();
+    _startup.poll();
+    _server.loop();
+
+    // Log queued events as soon as the radio reconnects, rather than at the end of the period.
+    // (Failed attempts are retried by 'loop()'.)
+    bool connected = _radio.isConnected();
+    if (connected && !_radio_connected && _startup.isReady()) {
+      uploadEvents();
+    }
+    _radio_connected = connected;
+    yield();
+  } while (millis() - start < milliseconds);
+}
+
+// Applies the configuration held by '_cloud' to the sampling pipeline.  Called once at
+// boot and again whenever updated config is retrieved from Firebase.
+void applyConfig() {
+  // Configure each channel's thermistor with Steinhart–Hart equation parameters from
+  // our config stored in Firebase.
+  for (int channel = 0; channel < Device::_max_channels; channel++) {
+    _thermistor[channel].init(
+      _cloud.getSeriesResistor(channel),
+      _cloud.getResistanceAt0(channel),
+      _cloud.getTemperatureAt0(channel),
+      _cloud.getBCoefficient(channel));
+  }
+
+  // Override the calibrated mux settling time, if configured.
+  if (_cloud.getMuxSettleMicros() > 0) {
+    _device.setSettleMicros(_cloud.getMuxSettleMicros());
+  }
+
+  // Configure how the raw ADC samples taken each period are combined.
+  for (int channel = 0; channel < Device::_max_channels; channel++) {
+    _filter[channel].init(
+      SampleFilter::parseMode(_cloud.getFilter()),
+      _cloud.getTrimPercent(),
+      _cloud.getHampelThreshold());
+  }
+
+  // Configure the tolerance within which logged samples may be dropped.
+  for (int channel = 0; channel < Device::_max_channels; channel++) {
+    _compression.setDeviation(channel, _cloud.getCompressionDeviation(channel));
+  }
+
+  // Configure the windows over which rolling temperature statistics are calculated.
+  _history.setStatsWindow(SampleHistory::ShortTerm, _cloud.getStatsWindow());
+  _history.setStatsWindow(SampleHistory::LongTerm, _cloud.getStatsLongWindow());
+
+  _log.setLevel(_cloud.getLogLevel());
+}
+
+// Console commands.  (Run from 'wait()', i.e., in the middle of a polling period, so anything
+// more than printing is deferred to 'loop()'.)
+void runHelp(uint8_t argc, char* argv[]) {
+  _console.printHelpTo(_log);
+}
+
+void runMetrics(uint8_t argc, char* argv[]) {
+  _metrics.printTo(_log);
+}
+
+void runConfig(uint8_t argc, char* argv[]) {
+  _cloud.printConfigTo(_log);
+}
+
+void runSet(uint8_t argc, char* argv[]) {
+  if (argc != 3) {
+    _log.println(F("Usage: set <name> <value>  (See 'config' for names.)"));
+    return;
+  }
+
+  if (!_cloud.set(argv[1], argv[2])) {
+    _log.print(F("Unknown setting or invalid value for '")); _log.print(argv[1]); _log.println(F("'.  (See 'config' for names.)"));
+    return;
+  }
+
+  _config_overridden = true;
+  _log.print(F("Set '")); _log.print(argv[1]); _log.println(F("' until the next config update."));
+}
+
+void runHistory(uint8_t argc, char* argv[]) {
+  uint16_t count = argc > 1 ? atoi(argv[1]) : 10;
+  _history.printTo(_log, count); _log.println();
+  _log.print(F("Pending upload: ")); _log.println(pendingCount());
+}
+
+void runLog(uint8_t argc, char* argv[]) {
+  _log.print(F("Log: ")); _log.print(_log.pending()); _log.print(F(" bytes buffered, "));
+  _log.print(_log.getDropped()); _log.print(F(" bytes dropped, level "));
+  _log.println(_log.getLevel());
+}
+
+void runFlush(uint8_t argc, char* argv[]) {
+  _flush_requested = true;
+  _log.println(F("Uploading pending samples at the end of this period."));
+}
+
+void runResync(uint8_t argc, char* argv[]) {
+  _resync_requested = true;
+  _log.println(F("Synchronizing the clock at the start of the next period."));
+}
+
+#if TRACE_ENABLED
+void runTrace(uint8_t argc, char* argv[]) {
+  _trace.printTo(_log);
+  if (argc > 1 && strcmp_P(argv[1], PSTR("clear")) == 0) {
+    _trace.clear();
+  }
+}
+#endif
+
+CONSOLE_STRINGS(help,     "- Lists commands.")
+CONSOLE_STRINGS(metrics,  "- Prints the metrics served at '/metrics'.")
+CONSOLE_STRINGS(config,   "- Prints the current config.")
+CONSOLE_STRINGS(set,      "<name> <value> - Overrides a config setting until the next config update.")
+CONSOLE_STRINGS(history,  "[count] - Prints the most recent samples.")
+CONSOLE_STRINGS(log,      "- Prints the state of the log's ring buffer.")
+CONSOLE_STRINGS(flush,    "- Uploads pending samples now.")
+CONSOLE_STRINGS(resync,   "- Synchronizes the clock with NTP now.")
+#if TRACE_ENABLED
+CONSOLE_STRINGS(trace,    "[clear] - Prints the recorded trace events.")
+#endif
+
+const Console::Command _commands[] PROGMEM = {
+  CONSOLE_COMMAND(help,     runHelp),
+  CONSOLE_COMMAND(metrics,  runMetrics),
+  CONSOLE_COMMAND(config,   runConfig),
+  CONSOLE_COMMAND(set,      runSet),
+  CONSOLE_COMMAND(history,  runHistory),
+  CONSOLE_COMMAND(log,      runLog),
+  CONSOLE_COMMAND(flush,    runFlush),
+  CONSOLE_COMMAND(resync,   runResync),
+#if TRACE_ENABLED
+  CONSOLE_COMMAND(trace,    runTrace),
+#endif
+};
 
 void setup() {
+  TRACE_BEGIN(Setup);
+
   // Use same baudrate as the ESP8266 bootloader, so that boot messages are readable.
   Serial.begin(74880);
 
   // Initialize hardware with initial settings (LED on, Relay open, etc.)
-  Serial.println();
-  Serial.println("Begin: Setup()");
+  LOGLN(MAIN, INFO);
+  LOGLN(MAIN, INFO, F("Begin: Setup()"));
   _device.init();
 
   // Load saved Wifi SSID/Password and Firebase auth/host info from built-in flash.
-  Serial.println();
-  LocalStorage localStorage;
-  localStorage.init(_device);
-
-  // Connect to WiFi.  If saved Wifi settings are missing or invalid, creates a
-  // captive portal that the end user can use to configure the device.
-  Serial.println();
-  Network network;
-  network.init(_device, localStorage);
-
-  // Connect to Firebase.
-  Serial.println();
-  _cloud.init(localStorage.getFirebaseHost(), localStorage.getFirebaseAuth());
-  
-  // Poll until we've been able to update our cloud-stored config for Firebase.
-  while (!_cloud.update(_device)) {
-    delay(300);
+  LOGLN(MAIN, INFO);
+  _local.init();
+
+  // Until the cloud config arrives, make decisions using the config retrieved from Firebase on
+  // a previous boot (if cached in flash), otherwise the defaults built into '_cloud'.
+  LOGLN(MAIN, INFO);
+  _cloud.loadCached(_local);
+  applyConfig();
+  for (int channel = 0; channel < Device::_max_channels; channel++) {
+    _last_adc[channel] = -1;
   }
 
-  // Begin synchronizing the 'Time' library with the NTP server.
-  Serial.println();
-  NTPTime ntp;
-  ntp.init(_cloud.getNtpServer(), _cloud.getGmtOffset());
+  // If we woke from deep sleep, take a sample and return to sleep if the collector is still
+  // idle.  (Returns if the device should instead boot normally, in which case the batched
+  // samples are logged once Firebase is reachable.)
+  if (_sleep.resume()) {
+    resumeSleep();
+    restoreBatch();
+    _below_minimum = _sleep.isBelowMinimum();
+  }
 
-  // Configure the thermistor class with Steinhart–Hart equation parameters from
-  // our config stored in Firebase.
-  Serial.println();
-  _thermistor.init(
-    _cloud.getSeriesResistor(),
-    _cloud.getResistanceAt0(),
-    _cloud.getTemperatureAt0(),
-    _cloud.getBCoefficient());
+  // Begin connecting to WiFi in the background.  Once connected, '_startup' continues with
+  // the local server, Firebase, cloud config and NTP while 'loop()' samples and controls the
+  // collector.  (If saved Wifi settings are missing, opens a captive portal in the background
+  // that the end user can use to configure the device.)
+  LOGLN(MAIN, INFO);
+  _startup.begin(_device, _local, _network, _cloud, _ntp, _server, _history);
+
+  // (Actuation latency is measured from no earlier than the first sample window.)
+  _uncrossed_millis = millis();
 
-  Serial.println("End: Setup()");
+  LOGLN(MAIN, INFO, F("End: Setup()"));
+  TRACE_END(Setup);
+
+  // From here on, 'wait()' drains buffered output to the UART in the background and runs
+  // commands typed into the serial monitor.
+  _log.setAsync(true);
+  _console.begin(_commands, sizeof(_commands) / sizeof(_commands[0]));
 }
 
 // Returns true if the collector should be engaged.  't0' is the temperature of the
@@ -69,7 +313,7 @@ bool getShouldEngageCollector(double t0, double t1) {
   // not engage the collector.
   double minT = _cloud.getMinTOn();
   if (t0 < minT || t1 < minT) {
-    Serial.print("Temperature below minimum safe operating temperature "); + Serial.print(minT); Serial.println(" celsius.");
+    LOG_TOKEN(MAIN, INFO, LogToken::BelowMinimum, minT);
     return false;
   }
 
@@ -80,41 +324,397 @@ bool getShouldEngageCollector(double t0, double t1) {
   double deltaTOff = _cloud.getDeltaTOff();
   
   if (delta > deltaTOn) {
-    Serial.print("Delta "); Serial.print(delta); Serial.print(" > "); Serial.print(deltaTOn); Serial.println(": Collector active.");
+    LOG_TOKEN(MAIN, DEBUG, LogToken::DeltaActive, delta, deltaTOn);
     return true;
   } else if (delta < deltaTOff) {
-    Serial.print("Delta "); Serial.print(delta); Serial.print(" < "); Serial.print(deltaTOff); Serial.println(": Collector inactive.");
+    LOG_TOKEN(MAIN, DEBUG, LogToken::DeltaInactive, delta, deltaTOff);
     return false;
   }
+
+  // Otherwise the delta is between 'deltaTOff' and 'deltaTOn'.  Leave the collector in its
+  // current state.
+  return _device.getRelay();
 }
 
-void loop() {
-  int oversample = _cloud.getOversample();                      // # of samples to take for each loop.
-  int duration = _cloud.getPollingMilliseconds() / oversample;  // Duration between sample points.
-
-  // Takes evenly spaced samples through the 'getPollingMilliseconds()' period.
-  double adc[2] = {};
-  for (int i = 0; i < oversample; i++) {
-    delay(duration);    
-    for (int channel = 0; channel < 2; channel++) {
-      uint32_t sample = _device.readAdc(channel);
-      Serial.print("adc"); Serial.print(channel); Serial.print(": "); Serial.println(sample);
-      adc[channel] += sample;
+// Returns true if the delta has crossed the threshold for changing the state of the relay
+// (i.e., above 'deltaTOn' while disengaged, or below 'deltaTOff' while engaged), whether or
+// not the relay changes.  (e.g., 'minTOn' may still hold it open.)
+bool hasCrossed(double t0, double t1) {
+  double delta = t1 - t0;
+  return _device.getRelay()
+    ? delta < _cloud.getDeltaTOff()
+    : delta > _cloud.getDeltaTOn();
+}
+
+// Returns how far (in Celsius) the temperatures are from changing the state of the relay.
+// (See 'getShouldEngageCollector()'.)  May be negative if the relay has yet to change.
+double getDecisionDistance(double t0, double t1) {
+  double delta = t1 - t0;
+  double coldest = min(t0, t1);
+  double minT = _cloud.getMinTOn();
+
+  // An engaged collector is disengaged when the delta falls to 'deltaTOff' or either
+  // temperature falls below the minimum.
+  if (_device.getRelay()) {
+    return min(delta - _cloud.getDeltaTOff(), coldest - minT);
+  }
+
+  // Otherwise it is engaged once the delta exceeds 'deltaTOn' and both temperatures are at
+  // least the minimum.
+  return max(_cloud.getDeltaTOn() - delta, minT - coldest);
+}
+
+// Samples each channel over a period of 'periodMillis' and records the filtered ADC values
+// and temperatures in 'sample'.  (If 'periodMillis' is 0, samples are taken back to back.)
+void takeSample(Sample& sample, uint32_t periodMillis) {
+  TRACE_SCOPE(TakeSample);
+
+  int channels = _cloud.getChannels();
+
+  // Choose the number of samples to take for each channel this period.  If adaptive
+  // oversampling is disabled (or the noise is not yet known), takes 'getOversample()'.
+  uint8_t samples[Device::_max_channels];
+  for (int channel = 0; channel < channels; channel++) {
+    samples[channel] = _last_adc[channel] < 0
+      ? _cloud.getOversample()
+      : _oversample[channel].sampleCount(
+          _thermistor[channel].celsiusPerLsb(_last_adc[channel]),
+          _cloud.getTargetStdErr(),
+          _cloud.getMinOversample(),
+          _cloud.getOversample());
+  }
+
+  // Samples are taken in bursts of up to 'getBurst()' consecutive reads per mux selection.
+  // Each round visits each channel that still needs samples once.
+  uint8_t burst = _cloud.getBurst();
+  uint8_t bursts[Device::_max_channels];
+  uint8_t rounds = 0;
+  for (int channel = 0; channel < channels; channel++) {
+    bursts[channel] = (samples[channel] + burst - 1) / burst;
+    rounds = max(rounds, bursts[channel]);
+  }
+
+  int duration = periodMillis / rounds;  // Duration between rounds of bursts.
+
+  // Takes evenly spaced bursts through the 'periodMillis' period.  A channel that needs
+  // fewer bursts than 'rounds' skips rounds so that its bursts remain evenly spaced.
+  for (int channel = 0; channel < channels; channel++) {
+    _filter[channel].reset();
+  }
+
+  for (int i = 0; i < rounds; i++) {
+    if (duration > 0) {
+      wait(duration);
+    }
+    for (int channel = 0; channel < channels; channel++) {
+      if ((i * bursts[channel]) / rounds == ((i + 1) * bursts[channel]) / rounds) {
+        continue;
+      }
+
+      for (int j = 0; j < burst && _filter[channel].count() < samples[channel]; j++) {
+        uint32_t adc = _device.readAdc(channel);
+        LOG_TOKEN(SENSOR, DEBUG, LogToken::AdcRaw, channel, adc);
+        _adc_reads_metric.inc();
+        _filter[channel].add(adc);
+      }
     }
   }
 
-  // Record timestamp and convert ADC averages to temperature readings.
-  time_t timestamp = now();
-  ThermistorReading t0 = _thermistor.toReading(adc[0] / oversample);
-  ThermistorReading t1 = _thermistor.toReading(adc[1] / oversample);
+  // Record timestamp and filter each channel's samples.  Also update each channel's noise
+  // estimate from this period's samples.
+  uint64_t timestamp = _clock.timestampMillis();
+  sample.time = timestamp / 1000;
+  sample.millis = timestamp % 1000;
+  sample.channels = channels;
+  for (int channel = 0; channel < channels; channel++) {
+    _oversample[channel].update(_filter[channel].variance());
+    sample.adc[channel] = _filter[channel].result();
+    sample.rejected[channel] = _filter[channel].rejected();
+  }
 
-  Serial.print("adc0: "); t0.print();
-  Serial.print("adc1: "); t1.print();
+  // Convert the filtered ADC values to temperature readings in a single pass.
+  for (int channel = 0; channel < channels; channel++) {
+    ThermistorReading reading = _thermistor[channel].toReading(sample.adc[channel]);
+    sample.celsius[channel] = reading._celsius;
+    _last_adc[channel] = reading._adc;
+
+    reading.print(channel);
+    LOG_TOKEN(SENSOR, DEBUG, LogToken::SamplesTaken, samples[channel], sample.rejected[channel]);
+  }
+
+  _samples_metric.inc();
+}
+
+// Returns true if the collector is idle (i.e., the relay is open and the collector is well
+// below the temperature at which it would engage), and deep sleep is enabled.
+bool isIdle(const Sample& sample) {
+  return _cloud.getDeepSleepSeconds() > 0
+    && !_device.getRelay()
+    && sample.celsius[1] - sample.celsius[0] < _cloud.getDeltaTOn() - _cloud.getDeepSleepMargin();
+}
+
+// Returns true if the pool or collector temperature is below 'minTOn'.
+bool isBelowMinimum(const Sample& sample) {
+  double minT = _cloud.getMinTOn();
+  return sample.celsius[0] < minT || sample.celsius[1] < minT;
+}
+
+// Restores the sample batched during deep sleep at 'index', converting its ADC values to
+// temperatures with the current thermistor config.
+void restoreSample(uint8_t index, Sample& sample) {
+  _sleep.get(index, sample);
+  for (int channel = 0; channel < sample.channels; channel++) {
+    sample.celsius[channel] = _thermistor[channel].toReading(sample.adc[channel])._celsius;
+  }
+}
+
+// Adds the samples batched during deep sleep to '_history' (for local clients.)  The batch
+// itself remains with '_sleep' until logged by 'upload()', as samples taken by 'loop()' before
+// startup completes are added to '_history' without being logged.
+void restoreBatch() {
+  for (uint8_t i = 0; i < _sleep.count(); i++) {
+    Sample sample;
+    restoreSample(i, sample);
+    _history.add(sample);
+  }
+}
+
+// Returns the number of samples not yet logged.
+uint16_t pendingCount() {
+  return _sleep.count() + _pending;
+}
+
+// Logs 'sample' to Firebase and records the time since it was taken.
+void logSample(const Sample& sample) {
+  int64_t takenMillis = static_cast<int64_t>(sample.time) * 1000 + sample.millis;
+  _sample_queue_metric.observe((static_cast<int64_t>(_clock.nowMicros() / 1000) - takenMillis) / 1000.0f);
+  _cloud.log(_device, sample);
+}
+
+// Logs 'sample' (unless within 'compressionDeviation' of the logged trend.)
+void compressAndLog(const Sample& sample) {
+  Sample logged[2];
+  uint8_t count = _compression.add(sample, logged);
+  for (uint8_t i = 0; i < count; i++) {
+    logSample(logged[i]);
+  }
+}
+
+// Logs the samples batched during deep sleep and those in '_history' not yet logged, once
+// 'getUploadEvery()' samples are pending (or as soon as the radio is connected, if 'force' is
+// true.)  Between uploads the radio is powered down, and woken one period before the next
+// upload is due so that it has time to reconnect.
+void upload(bool force) {
+  uint8_t uploadEvery = force ? 1 : _cloud.getUploadEvery();
+  if (pendingCount() + 1 >= uploadEvery) {
+    _radio.wake();
+  }
+
+  if (pendingCount() < uploadEvery || !_radio.isConnected()) {
+    return;
+  }
+
+  TRACE_SCOPE(Upload);
+
+  // The batch precedes any samples taken since waking.
+  for (uint8_t i = 0; i < _sleep.count(); i++) {
+    Sample sample;
+    restoreSample(i, sample);
+    compressAndLog(sample);
+  }
+  _sleep.clear();
+
+  // (Any samples older than the capacity of '_history' were lost.)
+  _pending = min(_pending, _history.count());
+  for (int age = _pending - 1; age >= 0; age--) {
+    compressAndLog(_history.at(age));
+  }
+  _pending = 0;
+
+  // When forced (e.g., by the console's 'flush'), also log the end of the current trend.
+  Sample held;
+  if (force && _compression.flush(held)) {
+    logSample(held);
+  }
+
+  if (_cloud.getUploadEvery() > 1) {
+    _radio.sleep();
+  }
+}
+
+// Logs each queued event with its own request, ahead of any pending samples.  If the radio is
+// powered down between uploads, it is woken as soon as an event is queued and the events are
+// logged once it reconnects.  (An event remains queued until it is logged successfully.)
+void uploadEvents() {
+  if (_events.isEmpty()) {
+    return;
+  }
+
+  _radio.wake();
+  if (!_radio.isConnected()) {
+    return;
+  }
+
+  while (!_events.isEmpty()) {
+    const Event& event = _events.front();
+    if (!_cloud.logEvent(_device, event)) {
+      return;
+    }
+
+    _event_queue_metric.observe((millis() - event.queued_millis) / 1000.0f);
+    _events.pop();
+  }
+
+  // Power the radio down again, unless 'upload()' needs it for the next batch.
+  uint8_t uploadEvery = _cloud.getUploadEvery();
+  if (uploadEvery > 1 && pendingCount() + 1 < uploadEvery && !_flush_requested) {
+    _radio.sleep();
+  }
+}
+
+// Called by 'setup()' after waking from deep sleep.  Takes a single sample and, if the collector
+// is still idle, batches it and returns to deep sleep without starting the network.  Returns
+// (so that the device boots normally) if the collector is no longer idle, if a temperature has
+// fallen below 'minTOn' (so that the event is logged), or if the batch is due to be uploaded.
+void resumeSleep() {
+  Sample sample;
+  takeSample(sample, /* periodMillis = */ 0);
+
+  bool belowMinimum = isBelowMinimum(sample);
+  bool idle = isIdle(sample) && !(belowMinimum && !_sleep.isBelowMinimum());
+  _sleep.update(idle);
+  if (idle) {
+    _sleep.setBelowMinimum(belowMinimum);
+  }
+  if (idle) {
+    _sleep.add(sample);
+  }
+
+  uint8_t uploadEvery = _cloud.getDeepSleepUploadEvery();
+  if (idle && _sleep.count() < uploadEvery) {
+    // Wake with the radio enabled if the batch will then be due for upload.
+    _sleep.sleep(_cloud.getDeepSleepSeconds(), _sleep.count() + 1 >= uploadEvery);
+  }
+
+  LOGLN(POWER, INFO, idle
+    ? F("Uploading batched samples.")
+    : F("Collector no longer idle, resuming normal operation."));
+
+  // The network cannot be started if this wake has the radio disabled.  Briefly sleep so
+  // that the device wakes again with the radio enabled.
+  if (!_sleep.isRadioOn()) {
+    _sleep.sleep(/* seconds = */ 1, /* radioOnWake = */ true);
+  }
+}
+
+void loop() {
+  TRACE_SCOPE(Loop);
+
+  // Apply any config retrieved from Firebase (or changed with the console's 'set') since the
+  // last period.
+  if (_startup.takeConfigUpdate() || _config_overridden) {
+    _config_overridden = false;
+    applyConfig();
+  }
+
+  // Periodically discipline the sample clock with the NTP-synchronized system time.
+  bool syncDue = _clock.isSyncDue() || _resync_requested;
+  _resync_requested = false;
+  if (_ntp.isSynchronized() && syncDue && _clock.sync()) {
+    LOG_TOKEN(CLOCK, INFO, LogToken::ClockSync, _clock.getDriftPpm(), _clock.getPendingMicros() / 1000);
+  }
+
+  // (Until the first sample is taken, polls at the minimum period.)
+  uint32_t periodMillis = _polling.getPeriodMillis() > 0
+    ? _polling.getPeriodMillis()
+    : _cloud.getPollingMinMilliseconds();
+
+  Sample sample;
+  takeSample(sample, periodMillis);
+
+  // The crossing that changes the relay occurred sometime after the end of the last window
+  // that had not crossed, which is kept until the relay actually changes.  (So the latency
+  // includes the blocking uploads and retries of the intervening iterations.)
+  if (!hasCrossed(sample.celsius[0], sample.celsius[1])) {
+    _uncrossed_millis = millis();
+  }
 
   // Given the temperature data, engage/disengage the collector as appropriate.
-  _device.setRelay(getShouldEngageCollector(t0._celsius, t1._celsius));
+  // (Channel 0 is the pool, channel 1 is the collector.)
+  uint32_t transitions = _device.getRelayTransitions();
+  _device.setRelay(getShouldEngageCollector(sample.celsius[0], sample.celsius[1]));
+  bool relayChanged = _device.getRelayTransitions() != transitions;
+  if (relayChanged) {
+    uint32_t latencyMillis = _device.getRelayChangedMillis() - _uncrossed_millis;
+    _actuation_latency_metric.observe(latencyMillis / 1000.0f);
+    LOGLN(MAIN, INFO, F("Relay changed "), latencyMillis, F("ms after the threshold was crossed."));
+
+    // The relay is now waiting on a different threshold, so the rate of approach measured so
+    // far no longer applies.
+    _polling.reset();
+  }
+  _device.verifyRelay();
+  sample.active = _device.getRelay();
+
+  // Queue relay transitions, and the temperatures falling below 'minTOn', to be logged ahead
+  // of the pending samples.
+  if (relayChanged) {
+    _events.push(sample.active ? EventType::RelayClosed : EventType::RelayOpened, sample);
+  }
+  bool belowMinimum = isBelowMinimum(sample);
+  if (belowMinimum && !_below_minimum) {
+    _events.push(EventType::BelowMinimum, sample);
+  }
+  _below_minimum = belowMinimum;
 
-  // Log the temperature data for this period, and the state of the solar collector.
-  _cloud.log(_device, timestamp, t0._adc, t1._adc, _device.getRelay());
-  Serial.println();
+  // Poll quickly while the temperatures are near (or quickly approaching) the next change of
+  // the relay, and back off while they are not.  (Fixed at 'pollingMilliseconds' unless the
+  // cloud config sets 'pollingMinMilliseconds' and 'pollingMaxMilliseconds'.)
+  _polling.update(
+    getDecisionDistance(sample.celsius[0], sample.celsius[1]),
+    millis(),
+    _cloud.getPollingMinMilliseconds(),
+    _cloud.getPollingMaxMilliseconds());
+
+  LOG_TOKEN(MAIN, INFO, LogToken::Relay,
+    sample.active ? F("closed") : F("open"),
+    _device.getRelayTransitions(),
+    _device.getRelayClosedMillis() / 1000);
+
+  // Push the sample to local clients before logging to the cloud, so local dashboards
+  // are not delayed by the Firebase round trip.
+  _history.add(sample);
+  TRACE_BEGIN(Publish);
+  _server.publish(sample);
+  TRACE_END(Publish);
+
+  // Log any events, then the temperature data for this period and the state of the solar
+  // collector.  (Skipped until Firebase is reachable and the clock has been synchronized.)
+  if (_startup.isReady()) {
+    _pending++;
+    uploadEvents();
+    upload(_flush_requested);
+    if (pendingCount() == 0) {
+      _flush_requested = false;
+    }
+  }
+  _radio.poll();
+
+  // Deep sleep once the collector has been idle for several consecutive periods.  (Only once
+  // the clock is synchronized and all samples are uploaded.)
+  if (_sleep.update(isIdle(sample)) >= _idle_periods_before_sleep && _startup.isReady() && pendingCount() == 0 && _events.isEmpty()) {
+    if (LOG_ENABLED(POWER, INFO)) {
+      _sleep.printEnergyTo(_log);
+    }
+
+    // Log the end of the current trend, which is otherwise lost with RAM.  (If the radio is
+    // powered down, the logged trend instead ends at the last logged sample.)
+    Sample held;
+    if (_radio.isConnected() && _compression.flush(held)) {
+      logSample(held);
+    }
+    _sleep.setBelowMinimum(_below_minimum);
+    _sleep.sleep(_cloud.getDeepSleepSeconds(), _cloud.getDeepSleepUploadEvery() <= 1);
+  }
+  LOGLN(MAIN, DEBUG);
 }
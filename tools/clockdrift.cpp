@@ -0,0 +1,142 @@
+/*
+ * clockdrift.cpp - Simulates the sample clock in firmware/MonotonicClock.h against a drifting
+ *                  crystal and jittery NTP references.
+ *
+ * Each scenario runs for several simulated hours.  'micros()' runs slow (or fast) by the
+ * crystal's frequency error.  The clock is synchronized every minute with the true time plus
+ * random jitter, starting after a delay (like the first NTP response after boot.)  Until then,
+ * timestamps come from the 'Time' library, which may have been set from an estimate (e.g.,
+ * by 'DeepSleep' after a wake) that is ahead of or behind the true time.
+ *
+ * A sample is timestamped every 5 seconds.  The simulation fails a scenario if any of these
+ * hold:
+ *
+ *    - Timestamps are not strictly increasing.
+ *    - The interval between consecutive samples is off by more than the slew rate allows.
+ *      (Unless the clock was stepped forward, e.g., from an estimate more than a second
+ *      behind.)  In particular, samples must never be clamped to 1ms apart.
+ *    - At the end, the clock is off by more than 10ms from the true time, or the estimated
+ *      drift is off by more than 2ppm.
+ *
+ * Build:
+ *
+ *    g++ -std=c++11 -O2 -Itools/host -o clockdrift tools/clockdrift.cpp
+ *
+ * Usage:
+ *
+ *    ./clockdrift
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../firmware/MonotonicClock.h"
+
+Log _log;
+
+struct Scenario {
+  const char* name;
+  double drift_ppm;                           // Crystal frequency error (positive runs slow)
+  bool   estimated;                           // True if the 'Time' library was set before sync
+  double estimate_error_seconds;              // Error of that estimate (positive is ahead)
+  bool   may_step;                            // True if the first sync may step forward
+                                              //   (i.e., the estimate is more than 1s behind)
+};
+
+static const Scenario _scenarios[] = {
+  { "clock not set, slow crystal",    40,   false, 0,     true  },
+  { "clock not set, fast crystal",    -25,  false, 0,     true  },
+  { "estimate 3s ahead",              40,   true,  3,     false },
+  { "estimate 0.4s ahead",            -25,  true,  0.4,   false },
+  { "estimate 5s behind",             40,   true,  -5,    true  },
+};
+
+static const double _start_seconds = 1.7e9;               // True UTC time at boot
+static const double _sample_seconds = 5;                  // Interval between samples
+static const double _first_sync_seconds = 20;             // Time from boot to the first NTP response
+static const double _sync_seconds = 60;                   // Interval between syncs
+static const double _duration_seconds = 8 * 60 * 60;
+static const double _jitter_millis = 5;                   // NTP jitter (uniform +/-)
+
+// Returns a random number in [-1..1).
+static double symmetric() {
+  return 2 * (rand() / (RAND_MAX + 1.0)) - 1;
+}
+
+static bool run(const Scenario& scenario) {
+  hostMicros = 0;
+  setTime(scenario.estimated ? static_cast<time_t>(_start_seconds + scenario.estimate_error_seconds) : 0);
+
+  MonotonicClock clock;
+  double local = 1 - scenario.drift_ppm * 1e-6;           // 'micros()' per true microsecond
+
+  uint64_t last = 0;
+  bool lastEstimated = false;                             // True if 'last' was taken before the first sync
+  double maxErrorMillis = 0;                              // Largest |interval - 5s|, excluding steps
+  int violations = 0;
+  double nextSync = _first_sync_seconds;
+
+  for (double t = _sample_seconds; t <= _duration_seconds; t += _sample_seconds) {
+    while (nextSync <= t) {
+      hostMicros = static_cast<uint64_t>(nextSync * 1e6 * local);
+      clock.poll();
+      double reference = (_start_seconds + nextSync) * 1e6 + symmetric() * _jitter_millis * 1000;
+      clock.sync(static_cast<uint64_t>(reference));
+      nextSync += _sync_seconds;
+    }
+
+    hostMicros = static_cast<uint64_t>(t * 1e6 * local);
+    clock.poll();
+    uint64_t timestamp = clock.timestampMillis();
+
+    if (last != 0) {
+      double interval = static_cast<double>(timestamp - last);
+      double error = interval - _sample_seconds * 1000;
+
+      // Slew and drift correction, plus a little for rounding.  (Until the first sync,
+      // timestamps have the 1 second resolution of 'now()'.)
+      double allowed = _sample_seconds * 1000 * (500 + fabs(scenario.drift_ppm) + 5) * 1e-6 + 1;
+      if (lastEstimated) {
+        allowed += 1000;
+      }
+
+      bool stepped = scenario.may_step && lastEstimated && error > 0;
+      if (fabs(error) > allowed && !stepped) {
+        if (violations++ < 3) {
+          printf("    t=%.0fs: interval %.0fms\n", t, interval);
+        }
+      }
+      if (!stepped) {
+        maxErrorMillis = fmax(maxErrorMillis, fabs(error));
+      }
+    }
+    if (timestamp <= last) {
+      printf("    t=%.0fs: timestamp did not increase\n", t);
+      violations++;
+    }
+    last = timestamp;
+    lastEstimated = t < _first_sync_seconds;
+  }
+
+  double trueMillis = (_start_seconds + _duration_seconds) * 1000;
+  double finalError = static_cast<double>(last) - trueMillis;
+  double driftError = clock.getDriftPpm() - scenario.drift_ppm;
+  bool failed = violations > 0 || fabs(finalError) > 10 || fabs(driftError) > 2;
+
+  printf("%-28s interval error max %8.1fms (%d violations), final error %6.2fms, drift %6.2fppm (%+.2f)%s\n",
+    scenario.name, maxErrorMillis, violations, finalError, clock.getDriftPpm(), driftError,
+    failed ? " [FAILED]" : "");
+  return !failed;
+}
+
+int main() {
+  srand(1);
+
+  int failures = 0;
+  for (const Scenario& scenario : _scenarios) {
+    failures += !run(scenario);
+  }
+
+  printf("%d of %zu scenarios failed.\n", failures, sizeof(_scenarios) / sizeof(_scenarios[0]));
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * fastgpiobench.cpp - Compares the GPIO access in firmware/FastGpio.h with the Arduino core's
+ *                     'digitalWrite()'/'digitalRead()', against mocked registers.
+ *
+ * Times one 'sample round' of the pin traffic in 'Device': selecting each of the 8 mux
+ * channels, blinking the LED on and off and reading back the relay.  Three implementations
+ * are compared:
+ *
+ *    digitalWrite  - As 'Device' did originally: 'digitalRead(0)' and a 'digitalWrite()' per
+ *                    select line on each mux switch, modelled on the core's out-of-line
+ *                    '__digitalWrite()'/'__digitalRead()' (waveform check, pin range checks.)
+ *    loop          - 'FastBus' with the masks looked up from a table in a loop over the bits.
+ *    FastGpio      - 'FastPin'/'FastBus' as in firmware/FastGpio.h.
+ *
+ * The registers are volatile variables, so every store is performed, but timings are of the
+ * host CPU.  Use them to compare the implementations, not as ESP8266 cycle counts.  (Build
+ * with -Os, as the Esp8266 Arduino core does.  At -O2 the compiler unrolls 'loop' and folds
+ * its table, hiding the difference.)
+ *
+ * Build:
+ *
+ *    g++ -std=c++11 -Os -Itools/host -o fastgpiobench tools/fastgpiobench.cpp
+ *
+ * Usage:
+ *
+ *    ./fastgpiobench [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "../firmware/FastGpio.h"
+
+// Pins as wired in firmware/Device.h.
+static const uint8_t _led_pin = 2;
+static const uint8_t _relay_pin = 4;
+static const uint8_t _mux_s0_pin = 0;
+static const uint8_t _mux_s1_pin = 5;
+static const uint8_t _mux_s2_pin = 14;
+
+// The channels selected in each round.  (Volatile, as in 'Device' the channel is not known at
+// compile time.)
+static volatile uint8_t _channels[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+// Pins with a PWM/tone waveform attached.  (None, but the core checks on every write.)
+static volatile uint32_t _waveform_enabled = 0;
+
+// Models the core's '__digitalWrite()'.  (Compiled separately in the core, so not inlined.)
+__attribute__((noinline)) void coreDigitalWrite(uint8_t pin, uint8_t value) {
+  if ((_waveform_enabled & (1UL << pin)) != 0) {
+    _waveform_enabled &= ~(1UL << pin);
+  }
+  if (pin < 16) {
+    if (value) {
+      GPOS = 1UL << pin;
+    } else {
+      GPOC = 1UL << pin;
+    }
+  } else if (pin == 16) {
+    digitalWrite(pin, value);
+  }
+}
+
+// Models the core's '__digitalRead()'.
+__attribute__((noinline)) int coreDigitalRead(uint8_t pin) {
+  if (pin < 16) {
+    return (GPI & (1UL << pin)) != 0;
+  } else if (pin == 16) {
+    return digitalRead(pin);
+  }
+  return 0;
+}
+
+// 'FastBus' as first written: the masks are looked up from a function-local table in a loop.
+template <uint8_t... Pins> class LoopBus {
+  private:
+    static const uint8_t _width = sizeof...(Pins);
+
+    static uint32_t pinMask(uint8_t i) {
+      static const uint32_t masks[_width] = { FastPin<Pins>::mask()... };
+      return masks[i];
+    }
+
+    static uint32_t maskOf(uint32_t value) {
+      uint32_t mask = 0;
+      for (uint8_t i = 0; i < _width; i++) {
+        if ((value & (1UL << i)) != 0) {
+          mask |= pinMask(i);
+        }
+      }
+      return mask;
+    }
+
+  public:
+    static void write(uint32_t value) {
+      uint32_t all = maskOf(0xFFFFFFFF);
+      uint32_t high = maskOf(value);
+
+      GPOS = high;
+      GPOC = all & ~high;
+    }
+};
+
+typedef FastPin<_led_pin> LedPin;
+typedef FastPin<_relay_pin> RelayPin;
+typedef FastBus<_mux_s0_pin, _mux_s1_pin, _mux_s2_pin> MuxBus;
+typedef LoopBus<_mux_s0_pin, _mux_s1_pin, _mux_s2_pin> LoopMuxBus;
+
+static bool roundDigitalWrite() {
+  for (int i = 0; i < 8; i++) {
+    uint8_t channel = _channels[i];
+    coreDigitalRead(0);
+    coreDigitalWrite(_mux_s0_pin, (channel & 0x01) != 0 ? HIGH : LOW);
+    coreDigitalWrite(_mux_s1_pin, (channel & 0x02) != 0 ? HIGH : LOW);
+    coreDigitalWrite(_mux_s2_pin, (channel & 0x04) != 0 ? HIGH : LOW);
+  }
+  coreDigitalWrite(_led_pin, LOW);
+  coreDigitalWrite(_led_pin, HIGH);
+  return coreDigitalRead(_relay_pin) != LOW;
+}
+
+static bool roundLoop() {
+  for (int i = 0; i < 8; i++) {
+    LoopMuxBus::write(_channels[i]);
+  }
+  LedPin::write(false);
+  LedPin::write(true);
+  return RelayPin::read();
+}
+
+static bool roundFastGpio() {
+  for (int i = 0; i < 8; i++) {
+    MuxBus::write(_channels[i]);
+  }
+  LedPin::write(false);
+  LedPin::write(true);
+  return RelayPin::read();
+}
+
+// Returns the mean time of 'rounds' calls of 'round' (in nanoseconds), taking the fastest of
+// several runs to reduce the effect of other activity on the host.
+static double time(bool (*round)(), long rounds) {
+  const int runs = 5;
+  double best = 0;
+
+  for (int run = 0; run < runs; run++) {
+    volatile bool sink = false;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rounds; i++) {
+      sink = round();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    (void) sink;
+
+    double nanos = std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+    if (run == 0 || nanos < best) {
+      best = nanos;
+    }
+  }
+  return best;
+}
+
+// Checks that 'write()' leaves the select lines of 'channel' in GPO (and no other pins.)
+template <typename Bus> static bool selects(int channel) {
+  GPO = 0;
+  Bus::write(channel);
+  hostApplyGpio();
+  uint32_t expected = ((channel & 0x01) != 0 ? 1UL << _mux_s0_pin : 0)
+    | ((channel & 0x02) != 0 ? 1UL << _mux_s1_pin : 0)
+    | ((channel & 0x04) != 0 ? 1UL << _mux_s2_pin : 0);
+  return GPO == expected;
+}
+
+int main(int argc, char* argv[]) {
+  long rounds = argc > 1 ? atol(argv[1]) : 2000000;
+
+  for (int channel = 0; channel < 8; channel++) {
+    if (!selects<MuxBus>(channel) || !selects<LoopMuxBus>(channel)) {
+      printf("Channel %d selected the wrong pins.\n", channel);
+      return 1;
+    }
+  }
+
+  double digitalWriteNanos = time(roundDigitalWrite, rounds);
+  double loopNanos = time(roundLoop, rounds);
+  double fastNanos = time(roundFastGpio, rounds);
+
+  printf("Per sample round (8 mux switches, LED on/off, relay read), %ld rounds:\n", rounds);
+  printf("  digitalWrite  %7.2f ns\n", digitalWriteNanos);
+  printf("  loop          %7.2f ns  (%.1fx)\n", loopNanos, digitalWriteNanos / loopNanos);
+  printf("  FastGpio      %7.2f ns  (%.1fx)\n", fastNanos, digitalWriteNanos / fastNanos);
+  return 0;
+}
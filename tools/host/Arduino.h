@@ -0,0 +1,53 @@
+#ifndef __ARDUINO_H__
+#define __ARDUINO_H__
+
+/*
+ * Arduino.h - Minimal stand-in for the Esp8266 Arduino core, so that firmware headers can be
+ *             built into the host tools.  (See tools/swingdoortest.cpp, etc.)
+ *
+ * Time is simulated: 'micros()' and 'millis()' return 'hostMicros', which the tool advances.
+ * The GPIO registers are ordinary variables, so writes can be inspected (and are not
+ * optimized away.)
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include "pgmspace.h"
+#include "Print.h"
+#include "HardwareSerial.h"
+
+#define HIGH 1
+#define LOW  0
+
+using std::min;
+using std::max;
+
+static uint64_t hostMicros = 0;
+
+// (As on the ESP8266, 'micros()' and 'millis()' are 32 bits and overflow.)
+inline uint32_t micros()          { return static_cast<uint32_t>(hostMicros); }
+inline uint32_t millis()          { return static_cast<uint32_t>(hostMicros / 1000); }
+inline void delay(unsigned long ms)               { hostMicros += ms * 1000ULL; }
+inline void delayMicroseconds(unsigned int us)    { hostMicros += us; }
+inline void yield() {}
+
+// GPIO registers (see 'esp8266_peri.h'.)  Writes to GPOS/GPOC are applied to GPO by
+// 'hostApplyGpio()'.
+static volatile uint32_t GPOS = 0;            // Write 1 to set
+static volatile uint32_t GPOC = 0;            // Write 1 to clear
+static volatile uint32_t GPO = 0;             // Output latch
+static volatile uint32_t GPI = 0;             // Input levels
+
+inline void hostApplyGpio() {
+  GPO = (GPO | GPOS) & ~GPOC;
+  GPOS = 0;
+  GPOC = 0;
+}
+
+static uint8_t hostPin16 = LOW;
+inline void digitalWrite(uint8_t pin, uint8_t value)  { if (pin == 16) hostPin16 = value; }
+inline int digitalRead(uint8_t pin)                   { return pin == 16 ? hostPin16 : LOW; }
+
+#endif // __ARDUINO_H__
@@ -0,0 +1,23 @@
+#ifndef __HARDWARE_SERIAL_H__
+#define __HARDWARE_SERIAL_H__
+
+/*
+ * HardwareSerial.h - Stand-in for the Esp8266 core's 'Serial', which writes to stdout.
+ */
+
+#include <stdio.h>
+#include "Print.h"
+
+class HardwareSerial : public Print {
+  public:
+    using Print::write;
+
+    size_t write(uint8_t c) override                          { return fputc(c, stdout) == EOF ? 0 : 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+    int availableForWrite()                                   { return 128; }
+    void flush()                                              { fflush(stdout); }
+};
+
+static HardwareSerial Serial;
+
+#endif // __HARDWARE_SERIAL_H__
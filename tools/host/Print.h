@@ -0,0 +1,58 @@
+#ifndef __PRINT_H__
+#define __PRINT_H__
+
+/*
+ * Print.h - Stand-in for the Arduino core's 'Print', with the overloads used by the firmware.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "pgmspace.h"
+
+class Print {
+  private:
+    template <typename T> size_t printFormatted(const char* format, T value) {
+      char buffer[32];
+      int length = snprintf(buffer, sizeof(buffer), format, value);
+      return write(reinterpret_cast<const uint8_t*>(buffer), length);
+    }
+
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      for (size_t i = 0; i < size; i++) {
+        write(buffer[i]);
+      }
+      return size;
+    }
+
+    size_t print(const char* s)                 { return write(reinterpret_cast<const uint8_t*>(s), strlen(s)); }
+    size_t print(const __FlashStringHelper* s)  { return print(reinterpret_cast<const char*>(s)); }
+    size_t print(char c)                        { return write(static_cast<uint8_t>(c)); }
+    size_t print(unsigned char v)               { return printFormatted("%u", v); }
+    size_t print(int v)                         { return printFormatted("%d", v); }
+    size_t print(unsigned int v)                { return printFormatted("%u", v); }
+    size_t print(long v)                        { return printFormatted("%ld", v); }
+    size_t print(unsigned long v)               { return printFormatted("%lu", v); }
+    size_t print(double v, int digits = 2) {
+      char buffer[32];
+      int length = snprintf(buffer, sizeof(buffer), "%.*f", digits, v);
+      return write(reinterpret_cast<const uint8_t*>(buffer), length);
+    }
+
+    size_t println()                            { return print("\r\n"); }
+    template <typename T> size_t println(T value) {
+      size_t n = print(value);
+      return n + println();
+    }
+    size_t println(double v, int digits) {
+      size_t n = print(v, digits);
+      return n + println();
+    }
+};
+
+#endif // __PRINT_H__
@@ -0,0 +1,15 @@
+#ifndef __TICKER_H__
+#define __TICKER_H__
+
+/*
+ * Ticker.h - Stand-in for the Esp8266 core's 'Ticker'.  (Callbacks are never run on the host.)
+ */
+
+class Ticker {
+  public:
+    template <typename... Args> void attach_ms(Args...)   {}
+    template <typename... Args> void attach(Args...)      {}
+    void detach()                                         {}
+};
+
+#endif // __TICKER_H__
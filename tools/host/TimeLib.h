@@ -0,0 +1,18 @@
+#ifndef __TIMELIB_H__
+#define __TIMELIB_H__
+
+/*
+ * TimeLib.h - Stand-in for the 'Time' library's system time.  (Advances with the simulated
+ *             'millis()' from the time given to 'setTime()'.)
+ */
+
+#include <time.h>
+#include "Arduino.h"
+
+static time_t hostTime = 0;                   // Time given to 'setTime()'
+static uint64_t hostTimeSetMicros = 0;        // 'hostMicros' when 'setTime()' was called
+
+inline time_t now()               { return hostTime + static_cast<time_t>((hostMicros - hostTimeSetMicros) / 1000000); }
+inline void setTime(time_t t)     { hostTime = t; hostTimeSetMicros = hostMicros; }
+
+#endif // __TIMELIB_H__
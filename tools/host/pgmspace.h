@@ -0,0 +1,25 @@
+#ifndef __PGMSPACE_H__
+#define __PGMSPACE_H__
+
+/*
+ * pgmspace.h - Stand-in for the Esp8266 core's flash access macros.  (On the host, "flash" is
+ *              ordinary memory.)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P               const char*
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*reinterpret_cast<const uint8_t*>(p))
+#define strlen_P            strlen
+#define strcmp_P            strcmp
+#define memcpy_P            memcpy
+#define snprintf_P          snprintf
+
+class __FlashStringHelper;
+#define F(s)                (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+
+#endif // __PGMSPACE_H__
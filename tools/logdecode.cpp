@@ -0,0 +1,139 @@
+/*
+ * logdecode.cpp - Decodes the serial output of firmware built with LOG_TOKENIZED=1.
+ *
+ * Text output is passed through unchanged.  Tokenized messages (see Log.h) are formatted
+ * with the format strings in firmware/LogTokens.h.  Rebuild the decoder whenever tokens are
+ * added to LogTokens.h.
+ *
+ * Build:
+ *
+ *    g++ -std=c++11 -O2 -o logdecode tools/logdecode.cpp
+ *
+ * Usage:
+ *
+ *    stty -F /dev/ttyUSB0 74880 raw
+ *    ./logdecode < /dev/ttyUSB0
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../firmware/LogTokens.h"
+
+static const char* const _formats[] = {
+  #define LOG_TOKEN_FORMAT(name, format) format,
+  LOG_TOKENS(LOG_TOKEN_FORMAT)
+  #undef LOG_TOKEN_FORMAT
+};
+
+static const uint8_t _token_count = static_cast<uint8_t>(LogToken::Count);
+
+// Reads a varint from stdin.  Returns false at the end of the input.
+static bool readVarint(uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = getchar();
+    if (c == EOF) {
+      return false;
+    }
+
+    value |= static_cast<uint64_t>(c & 0x7F) << shift;
+    if ((c & 0x80) == 0) {
+      return true;
+    }
+  }
+  return true;
+}
+
+// Reads and prints one argument for the specifier 'spec'.  Returns false at the end of the input.
+static bool printArgument(char spec) {
+  uint64_t value;
+
+  switch (spec) {
+    case 'd':
+    case 'u': {
+      if (!readVarint(value)) {
+        return false;
+      }
+      int64_t decoded = static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+      printf("%lld", static_cast<long long>(decoded));
+      return true;
+    }
+
+    case 'f': {
+      uint8_t bytes[sizeof(float)];
+      if (fread(bytes, 1, sizeof(bytes), stdin) != sizeof(bytes)) {
+        return false;
+      }
+      float single;
+      memcpy(&single, bytes, sizeof(single));
+      printf("%.2f", single);                   // (Matches 'Print::print(double)'.)
+      return true;
+    }
+
+    case 's': {
+      if (!readVarint(value)) {
+        return false;
+      }
+      for (uint64_t i = 0; i < value; i++) {
+        int c = getchar();
+        if (c == EOF) {
+          return false;
+        }
+        putchar(c);
+      }
+      return true;
+    }
+
+    default:
+      fprintf(stderr, "logdecode: unsupported specifier '%%%c'\n", spec);
+      return true;
+  }
+}
+
+// Decodes the message following a sync byte.  Returns false at the end of the input.
+static bool decodeMessage() {
+  int token = getchar();
+  if (token == EOF) {
+    return false;
+  }
+
+  if (token >= _token_count) {
+    printf("[unknown log token %d, decoder out of date?]\n", token);
+    return true;
+  }
+
+  for (const char* format = _formats[token]; *format != '\0'; format++) {
+    if (format[0] != '%') {
+      putchar(*format);
+    } else if (format[1] == '%') {
+      putchar('%');
+      format++;
+    } else if (format[1] != '\0') {
+      if (!printArgument(*++format)) {
+        return false;
+      }
+    }
+  }
+
+  // (The firmware's 'println()' ends text lines with CRLF.)
+  printf("\r\n");
+  return true;
+}
+
+int main() {
+  for (int c = getchar(); c != EOF; c = getchar()) {
+    if (c != _log_token_sync) {
+      putchar(c);
+    } else if (!decodeMessage()) {
+      break;
+    }
+
+    // Flush at the end of each line so the output can be followed live.
+    if (c == '\n' || c == _log_token_sync) {
+      fflush(stdout);
+    }
+  }
+
+  return 0;
+}
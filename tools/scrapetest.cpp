@@ -0,0 +1,292 @@
+/*
+ * scrapetest.cpp - Checks that firmware/Metrics.h prints valid Prometheus text exposition
+ *                  format (version 0.0.4).
+ *
+ * Registers a counter (held and read on demand), a gauge and a histogram, followed by a metric
+ * of the same kind for each entry of the firmware's table in firmware/MetricNames.h.  Prints
+ * the registry as 'GET /metrics' would, and parses the result the way a Prometheus scrape
+ * does:
+ *
+ *    - Lines end with '\n' alone.
+ *    - Each family has '# HELP' followed by '# TYPE', and is not repeated.  Help text has
+ *      no escapes other than '\\' and '\n'.
+ *    - Each sample belongs to the family of the preceding '# TYPE' (with the '_bucket', '_sum'
+ *      and '_count' suffixes for histograms), and its value parses completely as a number.
+ *    - Histogram buckets are cumulative, end with 'le="+Inf"' and agree with '_count'.
+ *
+ * Also compares the output of the test metrics with the expected text, and checks that the
+ * firmware's metric names have the 'dtc_' prefix and that only counters end in '_total'.
+ *
+ * Build:
+ *
+ *    g++ -std=c++11 -O2 -Itools/host -o scrapetest tools/scrapetest.cpp
+ *
+ * Usage:
+ *
+ *    ./scrapetest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <set>
+#include "../firmware/Metrics.h"
+#include "../firmware/MetricNames.h"
+
+Metrics _metrics;
+
+// Accumulates printed output.
+class StringPrint : public Print {
+  public:
+    std::string text;
+
+    size_t write(uint8_t c) override {
+      text += static_cast<char>(c);
+      return 1;
+    }
+};
+
+static int _failures = 0;
+
+static void fail(int line, const std::string& text, const char* reason) {
+  printf("line %d: %s\n    '%s'\n", line, reason, text.c_str());
+  _failures++;
+}
+
+static bool isMetricName(const std::string& name) {
+  if (name.empty() || isdigit(static_cast<unsigned char>(name[0]))) {
+    return false;
+  }
+  for (char c : name) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '_' && c != ':') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool hasSuffix(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Names of the families parsed by 'parse()'.
+static std::set<std::string> _families;
+
+// Parses 'text' as a scrape would, reporting each violation of the format.
+static void parse(const std::string& text) {
+  std::set<std::string>& families = _families;
+  std::string family;                         // Name from the last '# TYPE'
+  std::string type;
+  std::string helped;                         // Name from the last '# HELP'
+  double cumulative = 0;                      // Last bucket count of the current histogram
+  bool sawInf = false;
+
+  if (text.empty() || text.back() != '\n') {
+    fail(0, text, "output does not end with a newline");
+  }
+
+  int number = 0;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+    number++;
+
+    if (line.find('\r') != std::string::npos) {
+      fail(number, line, "line contains '\\r'");
+      continue;
+    }
+
+    if (line.compare(0, 7, "# HELP ") == 0) {
+      size_t space = line.find(' ', 7);
+      helped = line.substr(7, space == std::string::npos ? std::string::npos : space - 7);
+      if (!isMetricName(helped) || space == std::string::npos) {
+        fail(number, line, "malformed HELP");
+      }
+      for (size_t i = space; i < line.size(); i++) {
+        if (line[i] == '\\' && (++i == line.size() || (line[i] != '\\' && line[i] != 'n'))) {
+          fail(number, line, "HELP has an invalid escape");
+        }
+      }
+      continue;
+    }
+
+    if (line.compare(0, 7, "# TYPE ") == 0) {
+      size_t space = line.find(' ', 7);
+      family = line.substr(7, space == std::string::npos ? std::string::npos : space - 7);
+      type = space == std::string::npos ? "" : line.substr(space + 1);
+      cumulative = 0;
+      sawInf = false;
+
+      if (family != helped) {
+        fail(number, line, "TYPE does not follow the HELP of the same family");
+      }
+      if (type != "counter" && type != "gauge" && type != "histogram") {
+        fail(number, line, "unknown TYPE");
+      }
+      if (!families.insert(family).second) {
+        fail(number, line, "family is repeated");
+      }
+      continue;
+    }
+
+    if (line.empty() || line[0] == '#') {
+      fail(number, line, "unexpected line");
+      continue;
+    }
+
+    // Sample: name[{labels}] value
+    size_t nameEnd = line.find_first_of("{ ");
+    std::string name = line.substr(0, nameEnd);
+    std::string labels;
+    size_t valueStart = nameEnd;
+    if (nameEnd != std::string::npos && line[nameEnd] == '{') {
+      size_t close = line.find('}', nameEnd);
+      if (close == std::string::npos) {
+        fail(number, line, "unterminated labels");
+        continue;
+      }
+      labels = line.substr(nameEnd + 1, close - nameEnd - 1);
+      valueStart = close + 1;
+    }
+    if (valueStart == std::string::npos || line[valueStart] != ' ') {
+      fail(number, line, "missing value");
+      continue;
+    }
+
+    std::string valueText = line.substr(valueStart + 1);
+    char* parsedEnd;
+    double value = strtod(valueText.c_str(), &parsedEnd);
+    if (valueText.empty() || *parsedEnd != '\0') {
+      fail(number, line, "value is not a number");
+    }
+
+    if (type == "histogram") {
+      if (name == family + "_bucket") {
+        if (labels.compare(0, 4, "le=\"") != 0 || labels.back() != '"') {
+          fail(number, line, "bucket without an 'le' label");
+        }
+        if (value < cumulative) {
+          fail(number, line, "bucket counts are not cumulative");
+        }
+        cumulative = value;
+        sawInf = labels == "le=\"+Inf\"";
+      } else if (name == family + "_count") {
+        if (!sawInf || value != cumulative) {
+          fail(number, line, "count does not agree with the '+Inf' bucket");
+        }
+      } else if (name != family + "_sum") {
+        fail(number, line, "sample does not belong to the histogram");
+      }
+    } else if (name != family || !labels.empty()) {
+      fail(number, line, "sample does not belong to the family");
+    }
+
+    if (type == "counter" && (value < 0 || !hasSuffix(name, "_total"))) {
+      fail(number, line, "counter is negative or not named '_total'");
+    }
+    if (type != "counter" && hasSuffix(family, "_total")) {
+      fail(number, line, "only counters may be named '_total'");
+    }
+  }
+}
+
+METRIC_STRINGS(held,    "test_held_total",    "A counter updated by 'inc()'.")
+METRIC_STRINGS(read,    "test_read_total",    "A counter read on demand.")
+METRIC_STRINGS(gauge,   "test_gauge_celsius", "A gauge.")
+METRIC_STRINGS(latency, "test_latency_seconds", "A histogram.")
+
+static const float _latency_bounds[] = { 0.5, 1, 5 };
+
+Counter _held_metric { METRIC(held) };
+Counter _read_metric { METRIC(read), [](){ return 42u; } };
+Gauge _gauge_metric { METRIC(gauge) };
+Histogram<3> _latency_metric { METRIC(latency), _latency_bounds };
+
+// The firmware's metrics, each registered as a metric of the same kind.  (Only their names
+// and help text are from the firmware.)
+static const float _firmware_bounds[] = { 1, 10 };
+
+class CounterOf : public Counter {
+  public:
+    CounterOf(const __FlashStringHelper* name, const __FlashStringHelper* help) : Counter(name, help) { }
+};
+
+class GaugeOf : public Gauge {
+  public:
+    GaugeOf(const __FlashStringHelper* name, const __FlashStringHelper* help) : Gauge(name, help) { }
+};
+
+class HistogramOf : public Histogram<2> {
+  public:
+    HistogramOf(const __FlashStringHelper* name, const __FlashStringHelper* help)
+      : Histogram<2>(name, help, _firmware_bounds) { }
+};
+
+#define FIRMWARE_METRIC(id, kind, name, help) kind##Of _##id##_metric { METRIC(id) };
+METRIC_NAMES(FIRMWARE_METRIC)
+#undef FIRMWARE_METRIC
+
+static const char* const _firmware_names[] = {
+  #define FIRMWARE_METRIC_NAME(id, kind, name, help) name,
+  METRIC_NAMES(FIRMWARE_METRIC_NAME)
+  #undef FIRMWARE_METRIC_NAME
+};
+
+static const char _expected[] =
+  "# HELP test_held_total A counter updated by 'inc()'.\n"
+  "# TYPE test_held_total counter\n"
+  "test_held_total 3\n"
+  "# HELP test_read_total A counter read on demand.\n"
+  "# TYPE test_read_total counter\n"
+  "test_read_total 42\n"
+  "# HELP test_gauge_celsius A gauge.\n"
+  "# TYPE test_gauge_celsius gauge\n"
+  "test_gauge_celsius -1.250\n"
+  "# HELP test_latency_seconds A histogram.\n"
+  "# TYPE test_latency_seconds histogram\n"
+  "test_latency_seconds_bucket{le=\"0.500\"} 2\n"
+  "test_latency_seconds_bucket{le=\"1.000\"} 3\n"
+  "test_latency_seconds_bucket{le=\"5.000\"} 3\n"
+  "test_latency_seconds_bucket{le=\"+Inf\"} 4\n"
+  "test_latency_seconds_sum 12.750\n"
+  "test_latency_seconds_count 4\n";
+
+int main() {
+  _held_metric.inc();
+  _held_metric.inc(2);
+  _gauge_metric.set(-1.25);
+  _latency_metric.observe(0.25);
+  _latency_metric.observe(0.5);               // (Bounds are inclusive.)
+  _latency_metric.observe(1);
+  _latency_metric.observe(11);
+
+  StringPrint out;
+  _metrics.printTo(out);
+  fputs(out.text.c_str(), stdout);
+
+  parse(out.text);
+  if (out.text.compare(0, sizeof(_expected) - 1, _expected) != 0) {
+    printf("Output of the test metrics differs from the expected text.\n");
+    _failures++;
+  }
+
+  for (const char* name : _firmware_names) {
+    if (_families.count(name) == 0) {
+      printf("Firmware metric '%s' is missing or not served under its name.\n", name);
+      _failures++;
+    }
+    if (strncmp(name, "dtc_", 4) != 0) {
+      printf("Firmware metric '%s' does not have the 'dtc_' prefix.\n", name);
+      _failures++;
+    }
+  }
+
+  printf("%d failures.\n", _failures);
+  return _failures > 0 ? 1 : 0;
+}
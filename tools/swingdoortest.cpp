@@ -0,0 +1,127 @@
+/*
+ * swingdoortest.cpp - Checks the error bound of the sample compression in firmware/SwingingDoor.h.
+ *
+ * Feeds random sample streams (irregular timestamps, random walks with occasional steps and
+ * relay transitions) through 'SwingingDoor' and reconstructs every sample by linearly
+ * interpolating between the logged samples on either side of it.  Fails if any reconstructed
+ * temperature is further than its channel's deviation from the original, if a sample is
+ * logged with a different relay state than the samples it stands in for, or if the
+ * discarded count does not match the samples that were not logged.
+ *
+ * Build:
+ *
+ *    g++ -std=c++11 -O2 -Itools/host -o swingdoortest tools/swingdoortest.cpp
+ *
+ * Usage:
+ *
+ *    ./swingdoortest [streams]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "../firmware/SwingingDoor.h"
+
+// Permitted excess over the deviation, for float rounding of the slopes.
+static const double _tolerance = 1e-3;
+
+static double secondsOf(const Sample& sample) {
+  return static_cast<double>(sample.time) + sample.millis / 1000.0;
+}
+
+// Returns a random number in [0..1).
+static double uniform() {
+  return rand() / (RAND_MAX + 1.0);
+}
+
+int main(int argc, char* argv[]) {
+  int streams = argc > 1 ? atoi(argv[1]) : 200;
+  int failures = 0;
+
+  srand(1);
+  for (int stream = 0; stream < streams; stream++) {
+    const float deviation[2] = { 0.25f + (stream % 4) * 0.1f, 0.5f };
+
+    SwingingDoor door;
+    door.setDeviation(0, deviation[0]);
+    door.setDeviation(1, deviation[1]);
+
+    std::vector<Sample> all;
+    std::vector<Sample> logged;
+    Sample out[2];
+
+    double seconds = 1.7e9;
+    double pool = 20;
+    double collector = 30;
+    bool active = false;
+
+    for (int i = 0; i < 2000; i++) {
+      seconds += 2 + 20 * uniform();
+      pool += (uniform() - 0.5) * 0.2 * (stream % 3);
+      collector += (uniform() - 0.5) * 0.67;
+      if (uniform() < 0.02) {
+        collector += 3;
+      }
+      if (uniform() < 0.01) {
+        active = !active;
+      }
+
+      Sample sample = {};
+      sample.time = static_cast<time_t>(seconds);
+      sample.millis = static_cast<uint16_t>((seconds - sample.time) * 1000);
+      sample.channels = 2;
+      sample.celsius[0] = pool;
+      sample.celsius[1] = collector;
+      sample.active = active;
+      all.push_back(sample);
+
+      uint8_t count = door.add(sample, out);
+      for (uint8_t k = 0; k < count; k++) {
+        logged.push_back(out[k]);
+      }
+    }
+
+    Sample held;
+    if (door.flush(held)) {
+      logged.push_back(held);
+    }
+
+    // Reconstruct each sample from the logged samples on either side of it.
+    double worst = 0;
+    int stateErrors = 0;
+    size_t j = 0;
+    for (const Sample& sample : all) {
+      double t = secondsOf(sample);
+      while (j + 1 < logged.size() && secondsOf(logged[j + 1]) < t) {
+        j++;
+      }
+
+      const Sample& before = logged[j];
+      const Sample& after = j + 1 < logged.size() ? logged[j + 1] : logged[j];
+      double span = secondsOf(after) - secondsOf(before);
+      double u = span > 0 ? (t - secondsOf(before)) / span : 0;
+
+      for (int channel = 0; channel < 2; channel++) {
+        double reconstructed = before.celsius[channel] + u * (after.celsius[channel] - before.celsius[channel]);
+        worst = fmax(worst, fabs(reconstructed - sample.celsius[channel]) - deviation[channel]);
+      }
+
+      bool state = t >= secondsOf(after) ? after.active : before.active;
+      if (sample.active != state) {
+        stateErrors++;
+      }
+    }
+
+    uint32_t expectedDiscarded = all.size() - logged.size();
+    bool failed = worst > _tolerance || stateErrors > 0 || door.getDiscarded() != expectedDiscarded;
+    if (failed || stream % 40 == 0) {
+      printf("stream %d: %zu -> %zu logged (%u discarded), worst excess %.5f, state errors %d%s\n",
+        stream, all.size(), logged.size(), door.getDiscarded(), worst, stateErrors,
+        failed ? " [FAILED]" : "");
+    }
+    failures += failed;
+  }
+
+  printf("%d of %d streams failed.\n", failures, streams);
+  return failures > 0 ? 1 : 0;
+}
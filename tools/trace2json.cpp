@@ -0,0 +1,66 @@
+/*
+ * trace2json.cpp - Converts trace events printed by firmware built with TRACE_ENABLED=1
+ *                  (see firmware/Trace.h) to Chrome trace event JSON.
+ *
+ * Lines not beginning with '@' are ignored, so the input may be a complete serial capture
+ * or the body of 'GET /trace'.  Open the output at https://ui.perfetto.dev (or
+ * chrome://tracing.)
+ *
+ * Build:
+ *
+ *    g++ -std=c++11 -O2 -o trace2json tools/trace2json.cpp
+ *
+ * Usage:
+ *
+ *    curl http://<device-ip>/trace | ./trace2json > trace.json
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+int main() {
+  char line[256];
+  bool first = true;
+  uint32_t lastMicros = 0;
+  uint64_t wraps = 0;                         // 'micros()' overflows (every ~71 minutes)
+  unsigned long events = 0;
+
+  printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  while (fgets(line, sizeof(line), stdin) != nullptr) {
+    if (line[0] != '@') {
+      continue;
+    }
+
+    char name[64];
+    unsigned track;
+    unsigned long micros;
+    char phase;
+
+    if (sscanf(line, "@track %u %63s", &track, name) == 2) {
+      // Name the track's thread in the viewer.
+      printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+        first ? "" : ",\n", track, name);
+      first = false;
+    } else if (sscanf(line, "@dropped %lu", &micros) == 1) {
+      fprintf(stderr, "trace2json: %lu events were dropped after the device's buffer filled.\n", micros);
+    } else if (sscanf(line, "@%lu %c %u %63s", &micros, &phase, &track, name) == 4) {
+      // Unwrap the 32 bit timestamps.  (Assumes consecutive events are less than ~71 minutes apart.)
+      uint32_t now = static_cast<uint32_t>(micros);
+      if (events > 0 && now < lastMicros) {
+        wraps++;
+      }
+      lastMicros = now;
+
+      printf("%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%u}",
+        first ? "" : ",\n", name, phase, static_cast<unsigned long long>((wraps << 32) | now), track);
+      first = false;
+      events++;
+    }
+  }
+
+  printf("\n]}\n");
+  fprintf(stderr, "trace2json: %lu events.\n", events);
+  return 0;
+}